@@ -3,9 +3,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-#include <emscripten.h>
-#include <emscripten/html5.h>
-
+#include "platform.c"
 #include "sdl.c"
 
 typedef struct Globals
@@ -48,15 +46,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    int frequency = frequency = EM_ASM_INT_V({
-        var context;
-        try {
-            context = new AudioContext();
-        } catch (e) {
-            context = new webkitAudioContext(); // safari only
-        }
-        return context.sampleRate;
-    });
+    int frequency = get_audio_frequency();
 
     if (!setup_sdl_mixer(&globals->sdl, frequency)) {
         cleanup_sdl(&globals->sdl);
@@ -75,7 +65,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    emscripten_request_animation_frame_loop(main_loop, globals);
+    run_frame_loop(main_loop, globals);
 
     return 0;
 }
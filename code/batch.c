@@ -0,0 +1,187 @@
+// Draws textured quads in as few draw calls as possible.
+//
+// Each quad is four vertices written straight into a stream buffer and drawn
+// as two triangles through a static index buffer every batch shares, so it
+// costs two thirds of the vertex data six separate vertices would. Quads
+// build up until the batch is full or the program or texture changes, then
+// go out in one glDrawElements call.
+//
+// The batch doesn't know what's in a vertex: batch_quad hands back room for
+// BATCH_QUAD_VERTICES of them in the batch's vertex format, to be filled in
+// going round the quad, e.g. top left, top right, bottom right, bottom left.
+// Each of the stream's buffers gets a vertex array, so a flush that starts
+// where the last one in that buffer did binds its vertices in one call.
+//
+// A batch can go out in the middle of drawing, whenever it fills up, so
+// anything its quads need uploading first belongs in before_draw rather than
+// after the drawing.
+
+#define BATCH_QUAD_VERTICES 4
+#define BATCH_QUAD_INDICES 6
+
+// The most quads unsigned short indices can reach
+#define BATCH_MAX_QUADS (65536 / BATCH_QUAD_VERTICES)
+
+// Every batch draws from the same indices, made once for as many quads as
+// any batch can hold so it never needs replacing
+static GLuint shared_index_buffer = 0;
+
+typedef void (*BatchFunction)(void *user_data);
+
+typedef struct Batch
+{
+    StreamBuffer stream;
+    VertexArray arrays[STREAM_BUFFER_COUNT];
+    GLuint index_buffer;
+    int quads_size;
+    int quad_bytes;
+    int quad_count;
+    GLintptr first_offset;
+    GLuint program;
+    GLuint texture;
+    int draw_calls;
+
+    // Called before each draw with before_draw_data, if set
+    BatchFunction before_draw;
+    void *before_draw_data;
+} Batch;
+
+// Index buffer for quads_size quads of four vertices each. Anything else
+// drawing quads laid out the same way can share it.
+GLuint create_quad_index_buffer(int quads_size)
+{
+    assert(quads_size <= BATCH_MAX_QUADS);
+
+    uint16_t *indices = malloc(quads_size * BATCH_QUAD_INDICES *
+                               sizeof(*indices));
+    if (!indices) {
+        fprintf(stderr, "create_quad_index_buffer: out of memory\n");
+        return 0;
+    }
+
+    uint16_t *index = indices;
+
+    for (int i = 0; i < quads_size; ++i) {
+        uint16_t first = i * BATCH_QUAD_VERTICES;
+
+        *index++ = first;
+        *index++ = first + 1;
+        *index++ = first + 2;
+
+        *index++ = first;
+        *index++ = first + 2;
+        *index++ = first + 3;
+    }
+
+    GLuint buffer;
+
+    glGenBuffers(1, &buffer);
+    bind_buffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 quads_size * BATCH_QUAD_INDICES * sizeof(*indices), indices,
+                 GL_STATIC_DRAW);
+
+    free(indices);
+
+    return buffer;
+}
+
+bool create_batch(Batch *batch, const VertexFormat *format, int quads_size,
+                  StreamMode mode)
+{
+    batch->quads_size = quads_size;
+    batch->quad_bytes = BATCH_QUAD_VERTICES * format->stride;
+    batch->quad_count = 0;
+    batch->first_offset = 0;
+    batch->program = 0;
+    batch->texture = 0;
+    batch->draw_calls = 0;
+    batch->before_draw = NULL;
+    batch->before_draw_data = NULL;
+
+    if (!create_stream_buffer(&batch->stream, quads_size * batch->quad_bytes,
+                              mode)) {
+        return false;
+    }
+
+    assert(quads_size <= BATCH_MAX_QUADS);
+
+    if (!shared_index_buffer) {
+        shared_index_buffer = create_quad_index_buffer(BATCH_MAX_QUADS);
+        if (!shared_index_buffer) return false;
+    }
+
+    batch->index_buffer = shared_index_buffer;
+
+    int buffers_count = mode == STREAM_RING ? STREAM_BUFFER_COUNT : 1;
+
+    for (int i = 0; i < buffers_count; ++i) {
+        create_vertex_array(&batch->arrays[i], format,
+                            batch->stream.buffers[i], batch->index_buffer);
+    }
+
+    return true;
+}
+
+// Call once a frame before any quads
+void begin_batch(Batch *batch)
+{
+    batch->quad_count = 0;
+    batch->draw_calls = 0;
+
+    stream_begin_frame(&batch->stream);
+}
+
+// Draws everything batched so far
+void flush_batch(Batch *batch)
+{
+    if (batch->quad_count == 0) return;
+
+    if (batch->before_draw) batch->before_draw(batch->before_draw_data);
+
+    stream_flush(&batch->stream);
+
+    use_program(batch->program);
+    bind_texture(0, batch->texture);
+
+    bind_vertex_array(&batch->arrays[batch->stream.current],
+                      batch->first_offset);
+
+    glDrawElements(GL_TRIANGLES, batch->quad_count * BATCH_QUAD_INDICES,
+                   GL_UNSIGNED_SHORT, 0);
+
+    batch->quad_count = 0;
+    ++batch->draw_calls;
+}
+
+// Returns where to write the next quad's vertices, drawing what's batched
+// first if the quad can't join it.
+void *batch_quad(Batch *batch, GLuint program, GLuint texture)
+{
+    if (program != batch->program || texture != batch->texture ||
+        batch->quad_count == batch->quads_size) {
+        flush_batch(batch);
+
+        batch->program = program;
+        batch->texture = texture;
+    }
+
+    // Out of room this frame, so carry on in fresh storage
+    if (batch->stream.offset + batch->quad_bytes > batch->stream.size) {
+        flush_batch(batch);
+        stream_begin_frame(&batch->stream);
+    }
+
+    GLintptr offset;
+    void *vertices = stream_alloc(&batch->stream, batch->quad_bytes, &offset);
+
+    // The stream holds quads_size quads and starts afresh above when it's
+    // full, so a quad always fits
+    assert(vertices);
+
+    if (batch->quad_count == 0) batch->first_offset = offset;
+
+    ++batch->quad_count;
+
+    return vertices;
+}
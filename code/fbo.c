@@ -6,22 +6,27 @@
 #include <SDL2/SDL.h>
 #include <GLES2/gl2.h>
 
-#include <emscripten.h>
-#include <emscripten/html5.h>
-
+#include "platform.c"
 #include "maths.c"
 #include "sdl.c"
 #include "gl.c"
+#include "shader_manager.c"
+#include "vertex_format.c"
 #include "timing.c"
+#include "render_target.c"
+#include "pass_graph.c"
 
 #define TEXTURE_WIDTH 128
 #define TEXTURE_HEIGHT 64
-#define TEXTURE_BYTES_PER_PIXEL 4
-#define TEXTURE_BYTES (TEXTURE_WIDTH * TEXTURE_HEIGHT * TEXTURE_BYTES_PER_PIXEL)
+#define BLOOM_WIDTH (TEXTURE_WIDTH / 2)
+#define BLOOM_HEIGHT (TEXTURE_HEIGHT / 2)
 
 #define TRIANGLE_VERTICES 3
 #define QUAD_VERTICES (TRIANGLE_VERTICES * 2)
 
+#define POSITION_ATTRIBUTE_LOCATION 0
+#define TEXCOORD_ATTRIBUTE_LOCATION 1
+
 #define POSITION_COMPONENTS 2
 #define POSITION_BYTES (POSITION_COMPONENTS * sizeof(float))
 #define WORLD_TRIANGLE_BYTES (POSITION_BYTES * TRIANGLE_VERTICES)
@@ -30,17 +35,27 @@
 #define TEXCOORD_BYTES (TEXCOORD_COMPONENTS * sizeof(float))
 #define SCREEN_QUAD_BYTES ((POSITION_BYTES + TEXCOORD_BYTES) * QUAD_VERTICES)
 
+// Where native builds keep program binaries between runs. make native-fbo
+// creates it.
+#define SHADER_CACHE_DIRECTORY "build/native/shaders"
+
 typedef struct Renderer
 {
-    GLuint world_program;
-    GLuint screen_program;
-    GLuint texture;
-    GLuint fbo;
+    Program world_program;
+    Program screen_program;
+    Program bright_program;
+    Program blur_program;
+    Program composite_program;
     GLuint world_vbo;
     GLuint screen_vbo;
-    GLint screen_position_attribute;
-    GLint screen_texcoord_attribute;
-    GLint world_position_attribute;
+    VertexArray world_array;
+    VertexArray screen_array;
+    RenderTargetPool targets;
+    PassGraph graph;
+
+    // Set while the programs are still building
+    ShaderManager *shaders;
+    bool programs_failed;
 } Renderer;
 
 typedef struct Globals
@@ -50,88 +65,240 @@ typedef struct Globals
     Timing timing;
     int window_width;
     int window_height;
+    bool bloom;
+    bool bloom_key_down;
     float *vertices;
+
+    // Summed over every frame drawn, for print_gl_counters
+    int frames;
+    int64_t calls_made;
+    int64_t calls_saved;
+    int64_t uniforms_set;
+    int64_t uniforms_saved;
 } Globals;
 
+void draw_world_pass(PassGraph *graph, RenderPass *pass, void *user_data)
+{
+    Renderer *renderer = (Renderer *)user_data;
+
+    use_program(renderer->world_program.object);
+
+    bind_vertex_array(&renderer->world_array, 0);
+
+    glClearColor(0.1, 0.3, 0.5, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glDrawArrays(GL_TRIANGLES, 0, TRIANGLE_VERTICES);
+}
+
+// Every pass after the world draws its inputs over the whole output
+void draw_screen_quad(Renderer *renderer, Program *program)
+{
+    use_program(program->object);
+
+    bind_vertex_array(&renderer->screen_array, 0);
+
+    glDrawArrays(GL_TRIANGLES, 0, QUAD_VERTICES);
+}
+
+void draw_bright_pass(PassGraph *graph, RenderPass *pass, void *user_data)
+{
+    Renderer *renderer = (Renderer *)user_data;
+
+    draw_screen_quad(renderer, &renderer->bright_program);
+}
+
+// Blurs the pass's input along x, y in texels
+void draw_blur(Renderer *renderer, PassGraph *graph, RenderPass *pass,
+               float x, float y)
+{
+    RenderTarget *input = get_pass_input(graph, pass, 0);
+
+    set_uniform_vec2(&renderer->blur_program, "texel_step", x / input->width,
+                     y / input->height);
+
+    draw_screen_quad(renderer, &renderer->blur_program);
+}
+
+void draw_blur_x_pass(PassGraph *graph, RenderPass *pass, void *user_data)
+{
+    draw_blur((Renderer *)user_data, graph, pass, 1.0f, 0.0f);
+}
+
+void draw_blur_y_pass(PassGraph *graph, RenderPass *pass, void *user_data)
+{
+    draw_blur((Renderer *)user_data, graph, pass, 0.0f, 1.0f);
+}
+
+void draw_composite_pass(PassGraph *graph, RenderPass *pass, void *user_data)
+{
+    Renderer *renderer = (Renderer *)user_data;
+
+    glClearColor(0.0, 0.0, 0.0, 1.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    // Without the bloom input it's a plain copy
+    Program *program = pass->inputs_count > 1 ? &renderer->composite_program :
+                                                &renderer->screen_program;
+
+    draw_screen_quad(renderer, program);
+}
+
+// Reports how many GL calls the state cache let through and dropped
+void print_gl_counters(Globals *globals)
+{
+    int frames = globals->frames ? globals->frames : 1;
+
+    printf("per frame: %.1f state calls made, %.1f saved; %.1f uniforms set, "
+           "%.1f saved\n",
+           (double)globals->calls_made / frames,
+           (double)globals->calls_saved / frames,
+           (double)globals->uniforms_set / frames,
+           (double)globals->uniforms_saved / frames);
+}
+
+// Fills in the programs once the driver has built them all, so the frames
+// before can go on being drawn
+bool finish_renderer_programs(Renderer *renderer)
+{
+    ShaderManager *shaders = renderer->shaders;
+
+    bool built = finish_shader_programs(shaders);
+
+    printf("%d programs compiled, %d loaded, in %.1f ms\n",
+           shaders->programs_compiled, shaders->programs_loaded,
+           shaders->build_ms);
+
+    free(shaders);
+    renderer->shaders = NULL;
+
+    if (!built) return false;
+
+    // Every sampler but the bloom reads texture unit 0
+    set_uniform_int(&renderer->composite_program, "bloom_sampler", 1);
+
+    glReleaseShaderCompiler();
+
+    return true;
+}
+
 EM_BOOL main_loop(double time, void *user_data)
 {
     Globals *globals = (Globals *)user_data;
 
     double dt = update_timing(&globals->timing, time);
 
+    reset_gl_state_counters();
+
     SDL_PumpEvents();
 
     SDL *sdl = &globals->sdl;
     if (sdl->keyboard_state[SDL_SCANCODE_Q]) {
+        print_gl_counters(globals);
         cleanup_sdl(sdl);
         return EM_FALSE;
     }
 
-    // Render
-    {
-        Renderer *renderer = &globals->renderer;
-
-        // Render world to texture
-        {
-            glViewport(0, 0, TEXTURE_WIDTH, TEXTURE_HEIGHT);
-
-            glUseProgram(renderer->world_program);
-
-            glBindFramebuffer(GL_FRAMEBUFFER, renderer->fbo);
-
-            glBindBuffer(GL_ARRAY_BUFFER, renderer->world_vbo);
-
-            glDisableVertexAttribArray(renderer->screen_position_attribute);
-            glDisableVertexAttribArray(renderer->screen_texcoord_attribute);
-            glEnableVertexAttribArray(renderer->world_position_attribute);
+    Renderer *renderer = &globals->renderer;
 
-            glVertexAttribPointer(renderer->world_position_attribute,
-                                  POSITION_COMPONENTS, GL_FLOAT, GL_FALSE,
-                                  POSITION_BYTES, 0);
-
-            glClearColor(0.1, 0.3, 0.5, 1.0);
+    if (renderer->shaders) {
+        // Only the clear colour until then
+        if (!shader_programs_ready(renderer->shaders)) {
             glClear(GL_COLOR_BUFFER_BIT);
+            swap_sdl_window(sdl);
+            return EM_TRUE;
+        }
 
-            glDrawArrays(GL_TRIANGLES, 0, TRIANGLE_VERTICES);
+        if (!finish_renderer_programs(renderer)) {
+            renderer->programs_failed = true;
+            cleanup_sdl(sdl);
+            return EM_FALSE;
         }
+    }
 
-        // Render texture to screen
-        {
-            glViewport(0, 0, globals->window_width, globals->window_height);
+    bool bloom_key_down = sdl->keyboard_state[SDL_SCANCODE_B];
+    if (bloom_key_down && !globals->bloom_key_down) {
+        globals->bloom = !globals->bloom;
+    }
+    globals->bloom_key_down = bloom_key_down;
 
-            glUseProgram(renderer->screen_program);
+    // Render
+    {
+        PassGraph *graph = &renderer->graph;
 
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        begin_render_target_frame(&renderer->targets);
 
-            glBindBuffer(GL_ARRAY_BUFFER, renderer->screen_vbo);
+        begin_pass_graph(graph, globals->window_width, globals->window_height);
 
-            glDisableVertexAttribArray(renderer->world_position_attribute);
-            glEnableVertexAttribArray(renderer->screen_position_attribute);
-            glEnableVertexAttribArray(renderer->screen_texcoord_attribute);
+        GraphTarget world = add_graph_target(graph, TEXTURE_WIDTH,
+                                             TEXTURE_HEIGHT, TARGET_RGBA8);
+        GraphTarget bright = add_graph_target(graph, BLOOM_WIDTH,
+                                              BLOOM_HEIGHT, TARGET_RGB565);
+        GraphTarget blurred_x = add_graph_target(graph, BLOOM_WIDTH,
+                                                 BLOOM_HEIGHT, TARGET_RGB565);
+        GraphTarget blurred = add_graph_target(graph, BLOOM_WIDTH,
+                                               BLOOM_HEIGHT, TARGET_RGB565);
 
-            glVertexAttribPointer(renderer->screen_position_attribute,
-                                  POSITION_COMPONENTS, GL_FLOAT, GL_FALSE,
-                                  POSITION_BYTES + TEXCOORD_BYTES, 0);
+        add_render_pass(graph, "world", world, draw_world_pass, renderer);
 
-            glVertexAttribPointer(renderer->screen_texcoord_attribute,
-                                  TEXCOORD_COMPONENTS, GL_FLOAT, GL_FALSE,
-                                  POSITION_BYTES + TEXCOORD_BYTES,
-                                  (void *)POSITION_BYTES);
+        // Always declared; culled when the composite doesn't read them
+        RenderPass *pass =
+            add_render_pass(graph, "bright", bright, draw_bright_pass,
+                            renderer);
+        add_pass_input(graph, pass, world, GL_LINEAR);
 
-            glClearColor(0.0, 0.0, 0.0, 1.0);
-            glClear(GL_COLOR_BUFFER_BIT);
+        pass = add_render_pass(graph, "blur x", blurred_x, draw_blur_x_pass,
+                               renderer);
+        add_pass_input(graph, pass, bright, GL_LINEAR);
 
-            glDrawArrays(GL_TRIANGLES, 0, QUAD_VERTICES);
-        }
+        // Reuses the bright pass's target, which blur x is done with
+        pass = add_render_pass(graph, "blur y", blurred, draw_blur_y_pass,
+                               renderer);
+        add_pass_input(graph, pass, blurred_x, GL_LINEAR);
+
+        pass = add_render_pass(graph, "composite", GRAPH_SCREEN,
+                               draw_composite_pass, renderer);
+        add_pass_input(graph, pass, world, GL_NEAREST);
+        if (globals->bloom) add_pass_input(graph, pass, blurred, GL_LINEAR);
 
-        SDL_GL_SwapWindow(sdl->window);
+        execute_pass_graph(graph, &renderer->targets);
+
+        swap_sdl_window(sdl);
 
         ++globals->timing.fps;
     }
 
+    ++globals->frames;
+    globals->calls_made += gl_state.calls_made;
+    globals->calls_saved += gl_state.calls_saved;
+    globals->uniforms_set += gl_state.uniforms_set;
+    globals->uniforms_saved += gl_state.uniforms_saved;
+
     return EM_TRUE;
 }
 
+// Queues a program that draws a screen quad with fragment_shader_code
+bool add_screen_program(ShaderManager *shaders, Program *program,
+                        const char *fragment_shader_code)
+{
+    // In location order
+    static const char *const attributes[] = {"position", "texcoord"};
+
+    static const char vertex_shader_code[] =
+        "attribute vec2 position;\n"
+        "attribute vec2 texcoord;\n"
+        "varying vec2 varying_texcoord;\n"
+        "\n"
+        "void main()\n"
+        "{\n"
+        "    gl_Position = vec4(position, 0.0, 1.0);\n"
+        "    varying_texcoord = texcoord;\n"
+        "}";
+
+    return add_shader_program(shaders, program, vertex_shader_code,
+                              fragment_shader_code, attributes, 2);
+}
+
 int main(int argc, char *argv[])
 {
     Globals *globals = malloc(sizeof(*globals));
@@ -155,54 +322,74 @@ int main(int argc, char *argv[])
 
         glClearColor(0.1, 0.3, 0.5, 1.0);
 
-        // Setup Screen Shader Program
+        // Setup Shader Programs
         {
-            const char vertex_shader_code[] =
-                "attribute vec2 position;\n"
-                "attribute vec2 texcoord;\n"
+            ShaderManager *shaders = malloc(sizeof(*shaders));
+            if (!shaders) return 1;
+
+            create_shader_manager(shaders, SHADER_CACHE_DIRECTORY);
+
+            static const char fragment_shader_code[] =
+                "precision lowp float;\n"
                 "varying vec2 varying_texcoord;\n"
+                "uniform sampler2D sampler;\n"
                 "\n"
                 "void main()\n"
                 "{\n"
-                "    gl_Position = vec4(position, 0.0, 1.0);\n"
-                "    varying_texcoord = texcoord;\n"
+                "    gl_FragColor = texture2D(sampler, varying_texcoord);\n"
                 "}";
 
-            const char fragment_shader_code[] =
-                "precision lowp float;\n"
+            // Keeps what's brighter than the background
+            static const char bright_fragment_shader_code[] =
+                "precision mediump float;\n"
                 "varying vec2 varying_texcoord;\n"
                 "uniform sampler2D sampler;\n"
                 "\n"
                 "void main()\n"
                 "{\n"
-                "    gl_FragColor = texture2D(sampler, varying_texcoord);\n"
+                "    vec3 c = texture2D(sampler, varying_texcoord).rgb;\n"
+                "    float luma = dot(c, vec3(0.299, 0.587, 0.114));\n"
+                "    gl_FragColor =\n"
+                "        vec4(c * smoothstep(0.3, 0.4, luma), 1.0);\n"
                 "}";
 
-            renderer->screen_program = create_shader_program_from_code(
-                vertex_shader_code, fragment_shader_code);
-
-            if (renderer->screen_program == 0) return false;
-
-            if (!link_shader_program(renderer->screen_program)) {
-                return false;
-            }
-
-            glUseProgram(renderer->screen_program);
-
-            renderer->screen_position_attribute =
-                glGetAttribLocation(renderer->screen_program, "position");
-            renderer->screen_texcoord_attribute =
-                glGetAttribLocation(renderer->screen_program, "texcoord");
-
-            GLint location =
-                glGetUniformLocation(renderer->screen_program, "sampler");
+            // Nine tap Gaussian in five samples, using linear filtering to
+            // blend the pairs either side
+            static const char blur_fragment_shader_code[] =
+                "precision mediump float;\n"
+                "varying vec2 varying_texcoord;\n"
+                "uniform sampler2D sampler;\n"
+                "uniform vec2 texel_step;\n"
+                "\n"
+                "void main()\n"
+                "{\n"
+                "    vec2 uv = varying_texcoord;\n"
+                "    vec2 near_step = texel_step * 1.3846153846;\n"
+                "    vec2 far_step = texel_step * 3.2307692308;\n"
+                "    vec3 c = texture2D(sampler, uv).rgb * 0.2270270270;\n"
+                "    c += (texture2D(sampler, uv + near_step).rgb +\n"
+                "          texture2D(sampler, uv - near_step).rgb) *\n"
+                "         0.3162162162;\n"
+                "    c += (texture2D(sampler, uv + far_step).rgb +\n"
+                "          texture2D(sampler, uv - far_step).rgb) *\n"
+                "         0.0702702703;\n"
+                "    gl_FragColor = vec4(c, 1.0);\n"
+                "}";
 
-            glUniform1i(location, 0);
-        }
+            static const char composite_fragment_shader_code[] =
+                "precision mediump float;\n"
+                "varying vec2 varying_texcoord;\n"
+                "uniform sampler2D sampler;\n"
+                "uniform sampler2D bloom_sampler;\n"
+                "\n"
+                "void main()\n"
+                "{\n"
+                "    vec3 c = texture2D(sampler, varying_texcoord).rgb;\n"
+                "    c += texture2D(bloom_sampler, varying_texcoord).rgb;\n"
+                "    gl_FragColor = vec4(c, 1.0);\n"
+                "}";
 
-        // Setup World Shader Program
-        {
-            const char vertex_shader_code[] =
+            static const char world_vertex_shader_code[] =
                 "attribute vec2 position;\n"
                 "\n"
                 "void main()\n"
@@ -210,7 +397,7 @@ int main(int argc, char *argv[])
                 "    gl_Position = vec4(position, 0.0, 1.0);\n"
                 "}";
 
-            const char fragment_shader_code[] =
+            static const char world_fragment_shader_code[] =
                 "precision lowp float;\n"
                 "\n"
                 "void main()\n"
@@ -218,61 +405,41 @@ int main(int argc, char *argv[])
                 "    gl_FragColor = vec4(0.8, 0.2, 0.8, 1.0);\n"
                 "}";
 
-            renderer->world_program = create_shader_program_from_code(
-                vertex_shader_code, fragment_shader_code);
-
-            if (renderer->world_program == 0) return false;
-
-            if (!link_shader_program(renderer->world_program)) {
-                return false;
+            const char *const world_attributes[] = {"position"};
+
+            bool built =
+                add_screen_program(shaders, &renderer->screen_program,
+                                   fragment_shader_code) &&
+                add_screen_program(shaders, &renderer->bright_program,
+                                   bright_fragment_shader_code) &&
+                add_screen_program(shaders, &renderer->blur_program,
+                                   blur_fragment_shader_code) &&
+                add_screen_program(shaders, &renderer->composite_program,
+                                   composite_fragment_shader_code) &&
+                add_shader_program(shaders, &renderer->world_program,
+                                   world_vertex_shader_code,
+                                   world_fragment_shader_code,
+                                   world_attributes, 1) &&
+                submit_shader_programs(shaders);
+
+            if (!built) {
+                free(shaders);
+                return 1;
             }
 
-            renderer->world_position_attribute =
-                glGetAttribLocation(renderer->world_program, "position");
+            // main_loop finishes them once they're ready
+            renderer->shaders = shaders;
         }
 
-        glReleaseShaderCompiler();
-
-        // Setup Texture
-        {
-            glGenTextures(1, &renderer->texture);
-
-            glActiveTexture(GL_TEXTURE0);
-
-            glBindTexture(GL_TEXTURE_2D, renderer->texture);
-
-            // Generate blank pixels
-            {
-                uint8_t *pixels = malloc(TEXTURE_BYTES);
-                memset(pixels, UINT8_MAX, TEXTURE_BYTES);
-
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, TEXTURE_WIDTH,
-                             TEXTURE_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE,
-                             pixels);
+        set_active_texture(0);
 
-                free(pixels);
-            }
-
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        }
+        load_vertex_array_objects();
 
-        // Setup Framebuffer Object
+        // Setup Render Targets
         {
-            glGenFramebuffers(1, &renderer->fbo);
-
-            glBindFramebuffer(GL_FRAMEBUFFER, renderer->fbo);
+            create_render_target_pool(&renderer->targets);
 
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                                   GL_TEXTURE_2D, renderer->texture, 0);
-
-            GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-
-            if (status != GL_FRAMEBUFFER_COMPLETE) {
-                fprintf(stderr, "Incomplete FBO: %d\n", status);
-            }
+            globals->bloom = true;
         }
 
         // Setup Screen VBO
@@ -322,14 +489,22 @@ int main(int argc, char *argv[])
                 texcoord += TEXCOORD_COMPONENTS;
             }
 
-            glUseProgram(renderer->screen_program);
-
             glGenBuffers(1, &renderer->screen_vbo);
-            glBindBuffer(GL_ARRAY_BUFFER, renderer->screen_vbo);
+            bind_buffer(GL_ARRAY_BUFFER, renderer->screen_vbo);
             glBufferData(GL_ARRAY_BUFFER, SCREEN_QUAD_BYTES, vertices,
                          GL_STATIC_DRAW);
 
             free(vertices);
+
+            VertexFormat format = {0};
+
+            add_vertex_attribute(&format, POSITION_ATTRIBUTE_LOCATION,
+                                 POSITION_COMPONENTS, GL_FLOAT, GL_FALSE);
+            add_vertex_attribute(&format, TEXCOORD_ATTRIBUTE_LOCATION,
+                                 TEXCOORD_COMPONENTS, GL_FLOAT, GL_FALSE);
+
+            create_vertex_array(&renderer->screen_array, &format,
+                                renderer->screen_vbo, 0);
         }
 
         // Setup World VBO
@@ -342,18 +517,28 @@ int main(int argc, char *argv[])
                 1.0f, 0.0f,
             };
 
-            glUseProgram(renderer->world_program);
-
             glGenBuffers(1, &renderer->world_vbo);
-            glBindBuffer(GL_ARRAY_BUFFER, renderer->world_vbo);
+            bind_buffer(GL_ARRAY_BUFFER, renderer->world_vbo);
             glBufferData(GL_ARRAY_BUFFER, WORLD_TRIANGLE_BYTES, positions,
                          GL_STATIC_DRAW);
+
+            VertexFormat format = {0};
+
+            add_vertex_attribute(&format, POSITION_ATTRIBUTE_LOCATION,
+                                 POSITION_COMPONENTS, GL_FLOAT, GL_FALSE);
+
+            create_vertex_array(&renderer->world_array, &format,
+                                renderer->world_vbo, 0);
         }
     }
 
-    globals->timing.frame_start_time = emscripten_performance_now();
+    globals->timing.frame_start_time = get_time();
+
+    run_frame_loop(main_loop, globals);
 
-    emscripten_request_animation_frame_loop(main_loop, globals);
+#ifndef __EMSCRIPTEN__
+    print_gl_counters(globals);
+#endif
 
-    return 0;
+    return globals->renderer.programs_failed ? 1 : 0;
 }
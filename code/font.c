@@ -0,0 +1,1649 @@
+// Fonts whose glyphs are rasterized with FreeType the first time they're
+// drawn and packed into atlas pages, fixed size textures that several fonts
+// of the same mode can share.
+//
+// Each font looks its glyphs up by Unicode codepoint through an open
+// addressing hash table of its own, while the glyphs themselves and the space
+// they take up belong to the page. Space is handed out by a skyline packer:
+// the page is filled bottom up and only the height of each column span is
+// remembered. Once the skyline is full, the least recently used glyph with a
+// big enough slot gives its slot up to the new one, whichever font it
+// belongs to. If no slot fits and nothing on the page is needed this frame,
+// the whole page is cleared and packed again.
+//
+// Glyphs are rendered into a CPU copy of the page and only the rectangles
+// that changed are uploaded, by flush_atlas_page. generation changes whenever
+// a glyph is evicted, so anything that keeps texture coordinates around knows
+// to look them up again. Pinned glyphs are never evicted.
+//
+// preload_glyphs rasterizes whole ranges up front instead, spread over the
+// workers of a JobSystem from jobs.c, which has to be included first.
+//
+// FONT_SDF pages store a signed distance field instead of coverage: 128 on
+// the outline, rising inside and falling outside, reaching 0 and 255
+// SDF_SPREAD pixels away. Sampled with linear filtering and thresholded at
+// 0.5 in the shader, one atlas rasterized at a modest size draws sharp text
+// at any scale.
+//
+// Kerning is read from the font's 'kern' table once, when the font is
+// opened, for the pairs of codepoints in kerning_ranges. The non-zero pairs
+// are kept sorted in a flat array, so get_kerning is a binary search and
+// layout never calls into FreeType.
+//
+// Fonts can also be baked offline by tools/bake_font.c into a file that
+// load_baked_font reads straight into a Font and a page of its own. Building
+// with TEXT_BAKED_FONT leaves FreeType out entirely, so only baked fonts work,
+// and FONT_NO_GL leaves out everything that touches GL, for the tool.
+
+#ifndef TEXT_BAKED_FONT
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_TRUETYPE_TABLES_H
+#include FT_TRUETYPE_TAGS_H
+#endif
+
+#include <limits.h>
+#include <math.h>
+
+#define FONT_DPI 100
+#define FONT_ATLAS_SIZE 1024
+#define GLYPH_PADDING 1
+#define MAX_GLYPHS 1024
+#define GLYPH_TABLE_SIZE 2048
+#define MAX_PAGE_FONTS 8
+#define MAX_SKYLINE_NODES 256
+#define MAX_DIRTY_RECTS 32
+#define REPLACEMENT_CODEPOINT 0xFFFD
+#define SDF_SPREAD 6
+#define SDF_GLYPH_PADDING (SDF_SPREAD + 1)
+#define SDF_FAR 1e20f
+#define BAKED_FONT_MAGIC 0x544E4642 // "BFNT"
+#define BAKED_FONT_VERSION 5
+#define PRELOAD_CHUNK_SIZE 8
+
+// Codepoints kerned against each other, at most MAX_KERNED_CODEPOINTS of
+// them. Both ends must fit in 16 bits.
+#define MAX_KERNED_CODEPOINTS 256
+
+static const uint32_t kerning_ranges[][2] = {
+    {0x20, 0x7E},
+    {0xA0, 0xFF},
+};
+
+typedef enum FontMode
+{
+    FONT_BITMAP,
+    FONT_SDF,
+    FONT_MODES_COUNT,
+} FontMode;
+
+// owner is the index of the font the glyph belongs to in its page's fonts
+typedef struct Glyph
+{
+    uint32_t codepoint;
+    int owner;
+    int texture_x;
+    int texture_y;
+    int slot_width;
+    int slot_height;
+    int width;
+    int height;
+    int advance;
+    int bearing_x;
+    int bearing_y;
+
+    // The bitmap's corners on the page, normalized to unsigned shorts so they
+    // go straight into vertices
+    uint16_t u0;
+    uint16_t v0;
+    uint16_t u1;
+    uint16_t v1;
+
+    unsigned last_used;
+    int pins;
+} Glyph;
+
+// The left codepoint is in the high half of pair, so sorting by pair sorts
+// by left then right. amount is in pixels.
+typedef struct KerningPair
+{
+    uint32_t pair;
+    int32_t amount;
+} KerningPair;
+
+typedef struct SkylineNode
+{
+    int x;
+    int y;
+    int width;
+} SkylineNode;
+
+typedef struct Rect
+{
+    int x;
+    int y;
+    int width;
+    int height;
+} Rect;
+
+typedef struct Font Font;
+
+typedef struct AtlasPage
+{
+    FontMode mode;
+
+    // Holds a baked font, whose glyphs can't be rasterized again, so nothing
+    // else is packed into it
+    bool fixed;
+
+    // Which of the font manager's pages this is, for batching by page
+    int index;
+
+    Glyph glyphs[MAX_GLYPHS];
+    int glyphs_count;
+
+    Font *fonts[MAX_PAGE_FONTS];
+    int fonts_count;
+
+    SkylineNode skyline[MAX_SKYLINE_NODES];
+    int skyline_count;
+
+    uint8_t *pixels;
+    uint8_t *upload;
+    int texture_width;
+    int texture_height;
+    GLuint texture;
+
+    Rect dirty[MAX_DIRTY_RECTS];
+    int dirty_count;
+
+    unsigned frame;
+    unsigned generation;
+
+    // Running totals, for measuring
+    uint64_t glyphs_rasterized;
+    uint64_t bytes_uploaded;
+} AtlasPage;
+
+struct Font
+{
+#ifndef TEXT_BAKED_FONT
+    FT_Face face;
+    uint8_t *file_data;
+    long file_size;
+    int point_size;
+#endif
+    AtlasPage *page;
+    int owner;
+    float line_height;
+
+    // Index + 1 into the page's glyphs, 0 for an empty bucket
+    int16_t table[GLYPH_TABLE_SIZE];
+
+    KerningPair *kerning;
+    int kerning_count;
+};
+
+// A baked font file is this header followed by the glyph table, the glyphs,
+// the kerning pairs and then the atlas pixels, all exactly as they're laid
+// out in Font and AtlasPage. Fields are little endian and the sizes are
+// checked on load, so a layout change is caught rather than misread.
+typedef struct BakedFontHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t mode;
+    uint32_t glyph_bytes;
+    uint32_t table_size;
+    uint32_t glyphs_count;
+    uint32_t kerning_count;
+    uint32_t texture_width;
+    uint32_t texture_height;
+    float line_height;
+} BakedFontHeader;
+
+// Decodes one UTF-8 sequence and moves s past it. Malformed input decodes to
+// U+FFFD one byte at a time. Overlong encodings, surrogates and anything
+// past U+10FFFF are well formed but not allowed, so each of those decodes to
+// a single U+FFFD.
+uint32_t decode_utf8(const char **s)
+{
+    // The smallest codepoint each length may encode, indexed by length
+    static const uint32_t minimums[] = {0, 0, 0x80, 0x800, 0x10000};
+
+    const uint8_t *p = (const uint8_t *)*s;
+
+    uint32_t codepoint;
+    int length;
+
+    if (p[0] < 0x80) {
+        codepoint = p[0];
+        length = 1;
+    } else if ((p[0] & 0xE0) == 0xC0) {
+        codepoint = p[0] & 0x1F;
+        length = 2;
+    } else if ((p[0] & 0xF0) == 0xE0) {
+        codepoint = p[0] & 0x0F;
+        length = 3;
+    } else if ((p[0] & 0xF8) == 0xF0) {
+        codepoint = p[0] & 0x07;
+        length = 4;
+    } else {
+        *s += 1;
+        return REPLACEMENT_CODEPOINT;
+    }
+
+    for (int i = 1; i < length; ++i) {
+        if ((p[i] & 0xC0) != 0x80) {
+            *s += 1;
+            return REPLACEMENT_CODEPOINT;
+        }
+
+        codepoint = (codepoint << 6) | (p[i] & 0x3F);
+    }
+
+    *s += length;
+
+    if (codepoint < minimums[length] || codepoint > 0x10FFFF ||
+        (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+        return REPLACEMENT_CODEPOINT;
+    }
+
+    return codepoint;
+}
+
+int glyph_bucket(uint32_t codepoint)
+{
+    return (codepoint * 2654435761u) & (GLYPH_TABLE_SIZE - 1);
+}
+
+Glyph *find_glyph(Font *font, uint32_t codepoint)
+{
+    for (int bucket = glyph_bucket(codepoint); font->table[bucket];
+         bucket = (bucket + 1) & (GLYPH_TABLE_SIZE - 1)) {
+        Glyph *glyph = &font->page->glyphs[font->table[bucket] - 1];
+
+        if (glyph->codepoint == codepoint) return glyph;
+    }
+
+    return NULL;
+}
+
+void insert_glyph(Font *font, Glyph *glyph)
+{
+    int bucket = glyph_bucket(glyph->codepoint);
+
+    while (font->table[bucket]) {
+        bucket = (bucket + 1) & (GLYPH_TABLE_SIZE - 1);
+    }
+
+    font->table[bucket] = (int16_t)(glyph - font->page->glyphs) + 1;
+}
+
+// Removes glyph from the table, shifting later entries of the probe sequence
+// back so lookups never hit a gap.
+void remove_glyph(Font *font, Glyph *glyph)
+{
+    Glyph *glyphs = font->page->glyphs;
+    int index = (int)(glyph - glyphs) + 1;
+
+    int hole = glyph_bucket(glyph->codepoint);
+    while (font->table[hole] != index) {
+        hole = (hole + 1) & (GLYPH_TABLE_SIZE - 1);
+    }
+
+    int bucket = hole;
+    for (;;) {
+        bucket = (bucket + 1) & (GLYPH_TABLE_SIZE - 1);
+
+        if (!font->table[bucket]) break;
+
+        Glyph *other = &glyphs[font->table[bucket] - 1];
+        int home = glyph_bucket(other->codepoint);
+
+        // Move it back unless its home lies after the hole
+        if (((bucket - home) & (GLYPH_TABLE_SIZE - 1)) >=
+            ((bucket - hole) & (GLYPH_TABLE_SIZE - 1))) {
+            font->table[hole] = font->table[bucket];
+            hole = bucket;
+        }
+    }
+
+    font->table[hole] = 0;
+}
+
+// Pixels to add to the advance between left and right, usually negative
+int get_kerning(Font *font, uint32_t left, uint32_t right)
+{
+    if (left > 0xFFFF || right > 0xFFFF) return 0;
+
+    uint32_t pair = left << 16 | right;
+
+    int low = 0;
+    int high = font->kerning_count;
+
+    while (low < high) {
+        int middle = (low + high) / 2;
+
+        if (font->kerning[middle].pair < pair) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low < font->kerning_count && font->kerning[low].pair == pair) {
+        return font->kerning[low].amount;
+    }
+
+    return 0;
+}
+
+// Maps a texel edge to a GL_UNSIGNED_SHORT normalized texture coordinate,
+// where 0xFFFF is the far edge of the page
+uint16_t normalize_texel(int texel, int size)
+{
+    return ((uint64_t)texel * 0xFFFF + size / 2) / size;
+}
+
+void set_glyph_uvs(AtlasPage *page, Glyph *glyph)
+{
+    glyph->u0 = normalize_texel(glyph->texture_x, page->texture_width);
+    glyph->v0 = normalize_texel(glyph->texture_y, page->texture_height);
+    glyph->u1 = normalize_texel(glyph->texture_x + glyph->width,
+                                page->texture_width);
+    glyph->v1 = normalize_texel(glyph->texture_y + glyph->height,
+                                page->texture_height);
+}
+
+void mark_dirty(AtlasPage *page, int x, int y, int width, int height)
+{
+    Rect rect = {x, y, width, height};
+
+    // Bands of whole rows that touch, as preloads leave, go up as one
+    if (page->dirty_count > 0 && width == page->texture_width) {
+        Rect *last = &page->dirty[page->dirty_count - 1];
+
+        if (last->width == page->texture_width && y <= last->y + last->height &&
+            last->y <= y + height) {
+            int bottom = max_int(last->y + last->height, y + height);
+
+            last->y = min_int(last->y, y);
+            last->height = bottom - last->y;
+            return;
+        }
+    }
+
+    if (page->dirty_count < MAX_DIRTY_RECTS) {
+        page->dirty[page->dirty_count++] = rect;
+        return;
+    }
+
+    // Out of room, so grow the last one to cover both
+    Rect *last = &page->dirty[MAX_DIRTY_RECTS - 1];
+
+    int right = max_int(last->x + last->width, x + width);
+    int top = max_int(last->y + last->height, y + height);
+
+    last->x = min_int(last->x, x);
+    last->y = min_int(last->y, y);
+    last->width = right - last->x;
+    last->height = top - last->y;
+}
+
+void clear_atlas_page(AtlasPage *page)
+{
+    for (int i = 0; i < page->fonts_count; ++i) {
+        memset(page->fonts[i]->table, 0, sizeof(page->fonts[i]->table));
+    }
+
+    page->glyphs_count = 0;
+
+    page->skyline[0].x = 0;
+    page->skyline[0].y = 0;
+    page->skyline[0].width = page->texture_width;
+    page->skyline_count = 1;
+
+    memset(page->pixels, 0, page->texture_width * page->texture_height);
+
+    page->dirty_count = 0;
+    mark_dirty(page, 0, 0, page->texture_width, page->texture_height);
+
+    ++page->generation;
+}
+
+// Returns the lowest y a width wide rectangle can sit at if its left edge is
+// at node index, or -1 if it would stick out of the page.
+int skyline_fit(AtlasPage *page, int index, int width, int height)
+{
+    int x = page->skyline[index].x;
+
+    if (x + width > page->texture_width) return -1;
+
+    int y = 0;
+    int remaining = width;
+
+    for (int i = index; remaining > 0; ++i) {
+        y = max_int(y, page->skyline[i].y);
+
+        if (y + height > page->texture_height) return -1;
+
+        remaining -= page->skyline[i].width;
+    }
+
+    return y;
+}
+
+bool skyline_pack(AtlasPage *page, int width, int height, int *x, int *y)
+{
+    int best = -1;
+    int best_y = INT_MAX;
+    int best_width = INT_MAX;
+
+    for (int i = 0; i < page->skyline_count; ++i) {
+        int fit_y = skyline_fit(page, i, width, height);
+
+        if (fit_y < 0) continue;
+
+        if (fit_y < best_y ||
+            (fit_y == best_y && page->skyline[i].width < best_width)) {
+            best = i;
+            best_y = fit_y;
+            best_width = page->skyline[i].width;
+        }
+    }
+
+    if (best < 0 || page->skyline_count == MAX_SKYLINE_NODES) return false;
+
+    *x = page->skyline[best].x;
+    *y = best_y;
+
+    // The new node covers the rectangle's top edge
+    memmove(page->skyline + best + 1, page->skyline + best,
+            (page->skyline_count - best) * sizeof(*page->skyline));
+    ++page->skyline_count;
+
+    page->skyline[best].x = *x;
+    page->skyline[best].y = best_y + height;
+    page->skyline[best].width = width;
+
+    // Trim or drop the nodes it now shadows
+    int right = *x + width;
+    int i = best + 1;
+
+    while (i < page->skyline_count && page->skyline[i].x < right) {
+        SkylineNode *node = &page->skyline[i];
+
+        int shrink = right - node->x;
+
+        if (shrink < node->width) {
+            node->x += shrink;
+            node->width -= shrink;
+            break;
+        }
+
+        memmove(node, node + 1,
+                (page->skyline_count - i - 1) * sizeof(*page->skyline));
+        --page->skyline_count;
+    }
+
+    // Merge neighbours at the same height
+    for (i = 0; i + 1 < page->skyline_count; ++i) {
+        SkylineNode *node = &page->skyline[i];
+
+        if (node->y == node[1].y) {
+            node->width += node[1].width;
+
+            memmove(node + 1, node + 2,
+                    (page->skyline_count - i - 2) * sizeof(*page->skyline));
+            --page->skyline_count;
+            --i;
+        }
+    }
+
+    return true;
+}
+
+// The least recently used glyph that isn't pinned or needed this frame and,
+// if width is non-zero, whose slot can hold a width by height glyph.
+Glyph *find_lru_glyph(AtlasPage *page, int width, int height)
+{
+    Glyph *lru = NULL;
+
+    for (int i = 0; i < page->glyphs_count; ++i) {
+        Glyph *glyph = &page->glyphs[i];
+
+        if (glyph->last_used == page->frame || glyph->pins) continue;
+
+        if (width && (glyph->slot_width < width ||
+                      glyph->slot_height < height)) {
+            continue;
+        }
+
+        if (!lru || glyph->last_used < lru->last_used) lru = glyph;
+    }
+
+    return lru;
+}
+
+bool is_atlas_page_in_use(AtlasPage *page)
+{
+    for (int i = 0; i < page->glyphs_count; ++i) {
+        Glyph *glyph = &page->glyphs[i];
+
+        if (glyph->last_used == page->frame || glyph->pins) return true;
+    }
+
+    return false;
+}
+
+void evict_glyph(AtlasPage *page, Glyph *glyph)
+{
+    remove_glyph(page->fonts[glyph->owner], glyph);
+
+    if (glyph->slot_width) {
+        for (int row = 0; row < glyph->slot_height; ++row) {
+            memset(page->pixels +
+                       (glyph->texture_y + row) * page->texture_width +
+                       glyph->texture_x,
+                   0, glyph->slot_width);
+        }
+
+        mark_dirty(page, glyph->texture_x, glyph->texture_y, glyph->slot_width,
+                   glyph->slot_height);
+    }
+
+    ++page->generation;
+}
+
+// Takes the next unused glyph entry, with room on the page for a width by
+// height bitmap if it isn't empty.
+Glyph *pack_glyph(AtlasPage *page, int width, int height)
+{
+    if (page->glyphs_count == MAX_GLYPHS) return NULL;
+
+    int x = 0;
+    int y = 0;
+
+    if (width && height && !skyline_pack(page, width, height, &x, &y)) {
+        return NULL;
+    }
+
+    Glyph *glyph = &page->glyphs[page->glyphs_count++];
+
+    glyph->texture_x = x;
+    glyph->texture_y = y;
+    glyph->slot_width = width;
+    glyph->slot_height = height;
+    glyph->pins = 0;
+
+    return glyph;
+}
+
+// Finds a glyph entry and a slot on the page for a width by height bitmap,
+// evicting whatever has to go. Returns NULL if everything that could make
+// room is still needed this frame.
+Glyph *allocate_glyph(AtlasPage *page, int width, int height)
+{
+    Glyph *glyph = pack_glyph(page, width, height);
+    if (glyph) return glyph;
+
+    // Out of fresh space, so take over an old glyph's entry and slot
+    glyph = find_lru_glyph(page, width, height);
+    if (glyph) {
+        evict_glyph(page, glyph);
+        return glyph;
+    }
+
+    if (is_atlas_page_in_use(page)) {
+        fprintf(stderr, "allocate_glyph: atlas page is full\n");
+        return NULL;
+    }
+
+    clear_atlas_page(page);
+
+    glyph = pack_glyph(page, width, height);
+    if (!glyph) {
+        fprintf(stderr, "allocate_glyph: %dx%d won't fit in the atlas\n",
+                width, height);
+    }
+
+    return glyph;
+}
+
+// Sets up an empty page for mode's glyphs. It has no texture until
+// create_atlas_texture.
+bool init_atlas_page(AtlasPage *page, FontMode mode)
+{
+    page->mode = mode;
+    page->fixed = false;
+    page->fonts_count = 0;
+    page->texture_width = FONT_ATLAS_SIZE;
+    page->texture_height = FONT_ATLAS_SIZE;
+
+    page->pixels = malloc(page->texture_width * page->texture_height);
+    if (!page->pixels) {
+        fprintf(stderr, "init_atlas_page: out of memory\n");
+        return false;
+    }
+
+    clear_atlas_page(page);
+    page->generation = 0;
+
+    return true;
+}
+
+void add_font_to_page(AtlasPage *page, Font *font)
+{
+    assert(page->fonts_count < MAX_PAGE_FONTS);
+
+    font->page = page;
+    font->owner = page->fonts_count;
+
+    page->fonts[page->fonts_count++] = font;
+}
+
+#ifndef TEXT_BAKED_FONT
+// One dimensional squared Euclidean distance transform of f, as in
+// Felzenszwalb and Huttenlocher, "Distance Transforms of Sampled Functions".
+// vertices and boundaries are scratch space of n and n + 1 entries.
+void distance_transform_1d(float *f, int n, int stride, float *d,
+                           int *vertices, float *boundaries)
+{
+    int k = 0;
+    vertices[0] = 0;
+    boundaries[0] = -SDF_FAR;
+    boundaries[1] = SDF_FAR;
+
+    for (int q = 1; q < n; ++q) {
+        // Where the parabola from q overtakes the one from vertices[k]
+        int v = vertices[k];
+        float s = ((f[q * stride] + q * q) - (f[v * stride] + v * v)) /
+                  (2 * q - 2 * v);
+
+        while (s <= boundaries[k]) {
+            --k;
+            v = vertices[k];
+            s = ((f[q * stride] + q * q) - (f[v * stride] + v * v)) /
+                (2 * q - 2 * v);
+        }
+
+        ++k;
+        vertices[k] = q;
+        boundaries[k] = s;
+        boundaries[k + 1] = SDF_FAR;
+    }
+
+    k = 0;
+    for (int q = 0; q < n; ++q) {
+        while (boundaries[k + 1] < q) ++k;
+
+        int v = vertices[k];
+        d[q] = (q - v) * (q - v) + f[v * stride];
+    }
+
+    for (int q = 0; q < n; ++q) f[q * stride] = d[q];
+}
+
+// Squared distance from every pixel of grid to the nearest zero, in place
+void distance_transform_2d(float *grid, int width, int height, float *d,
+                           int *vertices, float *boundaries)
+{
+    for (int x = 0; x < width; ++x) {
+        distance_transform_1d(grid + x, height, width, d, vertices,
+                              boundaries);
+    }
+
+    for (int y = 0; y < height; ++y) {
+        distance_transform_1d(grid + y * width, width, 1, d, vertices,
+                              boundaries);
+    }
+}
+
+// Turns a coverage bitmap into a distance field SDF_SPREAD pixels bigger on
+// every side. Returns NULL if it runs out of memory.
+uint8_t *create_distance_field(const FT_Bitmap *bitmap, int width, int height)
+{
+    int pixels_count = width * height;
+    int longest = max_int(width, height);
+
+    uint8_t *field = malloc(pixels_count);
+    float *outside = malloc(pixels_count * sizeof(*outside));
+    float *inside = malloc(pixels_count * sizeof(*inside));
+    float *d = malloc(longest * sizeof(*d));
+    int *vertices = malloc(longest * sizeof(*vertices));
+    float *boundaries = malloc((longest + 1) * sizeof(*boundaries));
+
+    if (!field || !outside || !inside || !d || !vertices || !boundaries) {
+        fprintf(stderr, "create_distance_field: out of memory\n");
+        free(field);
+        field = NULL;
+        goto done;
+    }
+
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int bitmap_x = x - SDF_SPREAD;
+            int bitmap_y = y - SDF_SPREAD;
+
+            uint8_t coverage = 0;
+            if (bitmap_x >= 0 && bitmap_x < (int)bitmap->width &&
+                bitmap_y >= 0 && bitmap_y < (int)bitmap->rows) {
+                coverage = bitmap->buffer[bitmap_y * bitmap->pitch + bitmap_x];
+            }
+
+            outside[y * width + x] = coverage >= 128 ? 0.0f : SDF_FAR;
+            inside[y * width + x] = coverage >= 128 ? SDF_FAR : 0.0f;
+            field[y * width + x] = coverage;
+        }
+    }
+
+    distance_transform_2d(outside, width, height, d, vertices, boundaries);
+    distance_transform_2d(inside, width, height, d, vertices, boundaries);
+
+    for (int i = 0; i < pixels_count; ++i) {
+        float distance;
+
+        if (field[i] > 0 && field[i] < 255) {
+            // The outline crosses this pixel, and its coverage says roughly
+            // how far the centre is from it, which is much finer than the
+            // distance to the nearest pixel on the other side
+            distance = field[i] / 255.0f - 0.5f;
+        } else {
+            // Pixel centres are half a pixel from the edge between them
+            distance = inside[i] > 0.0f ? sqrtf(inside[i]) - 0.5f :
+                                          0.5f - sqrtf(outside[i]);
+        }
+
+        float value = 0.5f + distance / (2.0f * SDF_SPREAD);
+
+        field[i] = value <= 0.0f ? 0 :
+                   value >= 1.0f ? 255 :
+                                   (uint8_t)(value * 255.0f + 0.5f);
+    }
+
+done:
+    free(outside);
+    free(inside);
+    free(d);
+    free(vertices);
+    free(boundaries);
+
+    return field;
+}
+
+// A glyph rendered by FreeType, and turned into a distance field for FONT_SDF
+// pages, that isn't on a page yet. pixels either points into the face's
+// glyph slot or is owned.
+typedef struct GlyphBitmap
+{
+    uint32_t codepoint;
+    int width;
+    int height;
+    int advance;
+    int bearing_x;
+    int bearing_y;
+    const uint8_t *pixels;
+    int pitch;
+    uint8_t *owned;
+    Glyph *glyph;
+} GlyphBitmap;
+
+// Renders codepoint with face. The pixels are only good until the face
+// renders something else, unless keep is set.
+bool render_glyph_bitmap(FT_Face face, FontMode mode, uint32_t codepoint,
+                         bool keep, GlyphBitmap *out)
+{
+    FT_Error error = FT_Load_Char(face, codepoint, FT_LOAD_RENDER);
+    if (error) {
+        fprintf(stderr, "render_glyph_bitmap: FT_Load_Char U+%04X: %d\n",
+                codepoint, error);
+        return false;
+    }
+
+    FT_GlyphSlot slot = face->glyph;
+    FT_Bitmap *bitmap = &slot->bitmap;
+
+    out->codepoint = codepoint;
+    out->width = bitmap->width;
+    out->height = bitmap->rows;
+    out->advance = slot->advance.x >> 6;
+    out->bearing_x = slot->bitmap_left;
+    out->bearing_y = slot->bitmap_top;
+    out->pixels = bitmap->buffer;
+    out->pitch = bitmap->pitch;
+    out->owned = NULL;
+    out->glyph = NULL;
+
+    if (!out->width || !out->height) return true;
+
+    if (mode == FONT_SDF) {
+        out->width += SDF_SPREAD * 2;
+        out->height += SDF_SPREAD * 2;
+        out->bearing_x -= SDF_SPREAD;
+        out->bearing_y += SDF_SPREAD;
+
+        out->owned = create_distance_field(bitmap, out->width, out->height);
+        if (!out->owned) return false;
+    } else if (keep) {
+        out->owned = malloc(out->width * out->height);
+        if (!out->owned) {
+            fprintf(stderr, "render_glyph_bitmap: out of memory\n");
+            return false;
+        }
+
+        for (int row = 0; row < out->height; ++row) {
+            memcpy(out->owned + row * out->width,
+                   bitmap->buffer + row * bitmap->pitch, out->width);
+        }
+    } else {
+        return true;
+    }
+
+    out->pixels = out->owned;
+    out->pitch = out->width;
+
+    return true;
+}
+
+// Copies the bitmap into its glyph's slot on the page
+void copy_glyph_bitmap(AtlasPage *page, const GlyphBitmap *bitmap)
+{
+    const Glyph *glyph = bitmap->glyph;
+
+    for (int row = 0; row < bitmap->height; ++row) {
+        memcpy(page->pixels + (glyph->texture_y + row) * page->texture_width +
+                   glyph->texture_x,
+               bitmap->pixels + row * bitmap->pitch, bitmap->width);
+    }
+}
+
+// Finds room on the font's page for the bitmap and adds a glyph for it,
+// without copying its pixels over yet
+Glyph *place_glyph(Font *font, GlyphBitmap *bitmap)
+{
+    AtlasPage *page = font->page;
+
+    int width = bitmap->width;
+    int height = bitmap->height;
+
+    // Distance fields are scaled up, so linear filtering reaches further
+    // past their edges than it does for bitmaps
+    int padding = page->mode == FONT_SDF ? SDF_GLYPH_PADDING : GLYPH_PADDING;
+
+    Glyph *glyph = allocate_glyph(page, width ? width + padding : 0,
+                                  height ? height + padding : 0);
+    if (!glyph) return NULL;
+
+    glyph->codepoint = bitmap->codepoint;
+    glyph->owner = font->owner;
+    glyph->width = width;
+    glyph->height = height;
+    glyph->advance = bitmap->advance;
+    glyph->bearing_x = bitmap->bearing_x;
+    glyph->bearing_y = bitmap->bearing_y;
+    glyph->last_used = page->frame;
+
+    set_glyph_uvs(page, glyph);
+
+    insert_glyph(font, glyph);
+
+    bitmap->glyph = glyph;
+
+    ++page->glyphs_rasterized;
+
+    return glyph;
+}
+
+Glyph *rasterize_glyph(Font *font, uint32_t codepoint)
+{
+    AtlasPage *page = font->page;
+
+    GlyphBitmap bitmap;
+    if (!render_glyph_bitmap(font->face, page->mode, codepoint, false,
+                             &bitmap)) {
+        return NULL;
+    }
+
+    Glyph *glyph = place_glyph(font, &bitmap);
+
+    if (glyph && glyph->width && glyph->height) {
+        copy_glyph_bitmap(page, &bitmap);
+
+        mark_dirty(page, glyph->texture_x, glyph->texture_y, glyph->width,
+                   glyph->height);
+    }
+
+    free(bitmap.owned);
+
+    return glyph;
+}
+
+// Each worker renders with a FreeType library and face of its own, as
+// neither is safe to share between threads. They all read the one copy of
+// the font file.
+typedef struct PreloadJob
+{
+    Font *font;
+    const uint32_t *codepoints;
+    GlyphBitmap *bitmaps;
+    bool *rendered;
+    FT_Library libraries[MAX_WORKERS];
+    FT_Face faces[MAX_WORKERS];
+} PreloadJob;
+
+// The calling thread is worker 0 and uses the font's own face
+FT_Face get_worker_face(PreloadJob *job, int worker)
+{
+    if (worker == 0) return job->font->face;
+    if (job->faces[worker]) return job->faces[worker];
+
+    Font *font = job->font;
+
+    // The library outlives a failed face and is freed with the rest
+    if (!job->libraries[worker]) {
+        FT_Error error = FT_Init_FreeType(&job->libraries[worker]);
+        if (error) {
+            fprintf(stderr, "get_worker_face: FT_Init_FreeType: %d\n", error);
+            job->libraries[worker] = NULL;
+            return NULL;
+        }
+    }
+
+    FT_Face face;
+
+    FT_Error error = FT_New_Memory_Face(job->libraries[worker],
+                                        font->file_data, font->file_size, 0,
+                                        &face);
+    if (error) {
+        fprintf(stderr, "get_worker_face: FT_New_Memory_Face: %d\n", error);
+        return NULL;
+    }
+
+    error = FT_Set_Char_Size(face, font->point_size * 64, 0, FONT_DPI, 0);
+    if (error) {
+        fprintf(stderr, "get_worker_face: FT_Set_Char_Size: %d\n", error);
+        FT_Done_Face(face);
+        return NULL;
+    }
+
+    job->faces[worker] = face;
+
+    return face;
+}
+
+void render_glyphs_chunk(void *user_data, int begin, int end, int worker)
+{
+    PreloadJob *job = (PreloadJob *)user_data;
+
+    FT_Face face = get_worker_face(job, worker);
+    if (!face) return;
+
+    for (int i = begin; i < end; ++i) {
+        job->rendered[i] =
+            render_glyph_bitmap(face, job->font->page->mode,
+                                job->codepoints[i], true, &job->bitmaps[i]);
+    }
+}
+
+void copy_glyphs_chunk(void *user_data, int begin, int end, int worker)
+{
+    PreloadJob *job = (PreloadJob *)user_data;
+
+    for (int i = begin; i < end; ++i) {
+        if (job->bitmaps[i].glyph) {
+            copy_glyph_bitmap(job->font->page, &job->bitmaps[i]);
+        }
+    }
+}
+
+// Rasterizes every codepoint in ranges that isn't on the font's page yet,
+// spread across jobs' workers, so loading a big character set scales with
+// the cores. Glyphs are packed in codepoint order, as get_glyph would have,
+// and the rows they cover are marked dirty together so flush_atlas_page
+// uploads them in one call. Glyphs that can't be rendered are skipped, and
+// once the page is full the rest are left to be rasterized as they're used.
+bool preload_glyphs(Font *font, JobSystem *jobs, const uint32_t ranges[][2],
+                    int ranges_count)
+{
+    AtlasPage *page = font->page;
+
+    int codepoints_size = 0;
+    for (int i = 0; i < ranges_count; ++i) {
+        codepoints_size += ranges[i][1] - ranges[i][0] + 1;
+    }
+
+    PreloadJob *job = calloc(1, sizeof(*job));
+    uint32_t *codepoints = malloc(codepoints_size * sizeof(*codepoints));
+    GlyphBitmap *bitmaps = calloc(codepoints_size, sizeof(*bitmaps));
+    bool *rendered = calloc(codepoints_size, sizeof(*rendered));
+
+    if (!job || !codepoints || !bitmaps || !rendered) {
+        fprintf(stderr, "preload_glyphs: out of memory\n");
+        free(job);
+        free(codepoints);
+        free(bitmaps);
+        free(rendered);
+        return false;
+    }
+
+    int codepoints_count = 0;
+
+    for (int i = 0; i < ranges_count; ++i) {
+        for (uint32_t codepoint = ranges[i][0]; codepoint <= ranges[i][1];
+             ++codepoint) {
+            if (!find_glyph(font, codepoint)) {
+                codepoints[codepoints_count++] = codepoint;
+            }
+        }
+    }
+
+    job->font = font;
+    job->codepoints = codepoints;
+    job->bitmaps = bitmaps;
+    job->rendered = rendered;
+
+    // Setup Bitmaps
+    run_parallel_for(jobs, codepoints_count, PRELOAD_CHUNK_SIZE,
+                     render_glyphs_chunk, job);
+
+    // Packing decides where everything goes, so it's done in order here
+    int top = page->texture_height;
+    int bottom = 0;
+
+    for (int i = 0; i < codepoints_count; ++i) {
+        if (!rendered[i]) continue;
+
+        // The page is full, so the rest are left to get_glyph
+        Glyph *glyph = place_glyph(font, &bitmaps[i]);
+        if (!glyph) break;
+
+        if (!glyph->width || !glyph->height) continue;
+
+        top = min_int(top, glyph->texture_y);
+        bottom = max_int(bottom, glyph->texture_y + glyph->height);
+    }
+
+    // Every glyph has its own slot, so the copies can't overlap
+    run_parallel_for(jobs, codepoints_count, PRELOAD_CHUNK_SIZE,
+                     copy_glyphs_chunk, job);
+
+    if (bottom > top) {
+        mark_dirty(page, 0, top, page->texture_width, bottom - top);
+    }
+
+    for (int i = 0; i < codepoints_count; ++i) free(bitmaps[i].owned);
+
+    for (int i = 1; i < MAX_WORKERS; ++i) {
+        if (job->faces[i]) FT_Done_Face(job->faces[i]);
+        if (job->libraries[i]) FT_Done_FreeType(job->libraries[i]);
+    }
+
+    free(job);
+    free(codepoints);
+    free(bitmaps);
+    free(rendered);
+
+    return true;
+}
+
+// A glyph that codepoint in kerning_ranges maps to. Several codepoints can
+// share one glyph.
+typedef struct KernedGlyph
+{
+    FT_UInt index;
+    uint32_t codepoint;
+} KernedGlyph;
+
+int compare_kerned_glyphs(const void *a, const void *b)
+{
+    const KernedGlyph *left = a;
+    const KernedGlyph *right = b;
+
+    if (left->index != right->index) {
+        return left->index < right->index ? -1 : 1;
+    }
+
+    return 0;
+}
+
+int compare_kerning_pairs(const void *a, const void *b)
+{
+    const KerningPair *left = a;
+    const KerningPair *right = b;
+
+    if (left->pair != right->pair) return left->pair < right->pair ? -1 : 1;
+
+    return 0;
+}
+
+// Where the glyphs with index start in glyphs, which is sorted by index.
+// Returns count if there are none.
+int find_kerned_glyph(const KernedGlyph *glyphs, int count, FT_UInt index)
+{
+    int low = 0;
+    int high = count;
+
+    while (low < high) {
+        int middle = (low + high) / 2;
+
+        if (glyphs[middle].index < index) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low < count && glyphs[low].index == index ? low : count;
+}
+
+uint16_t read_big_endian_u16(const uint8_t *p)
+{
+    return p[0] << 8 | p[1];
+}
+
+bool add_kerning_pair(Font *font, int *kerning_size, uint32_t pair,
+                      int amount)
+{
+    if (font->kerning_count == *kerning_size) {
+        *kerning_size = max_int(*kerning_size * 2, 256);
+
+        KerningPair *pairs =
+            realloc(font->kerning, *kerning_size * sizeof(*pairs));
+        if (!pairs) {
+            fprintf(stderr, "load_kerning: out of memory\n");
+            return false;
+        }
+
+        font->kerning = pairs;
+    }
+
+    font->kerning[font->kerning_count++] = (KerningPair){pair, amount};
+
+    return true;
+}
+
+// Adds the pairs in one format 0 'kern' subtable between glyphs of
+// kerning_ranges, scaled to pixels the way FT_Get_Kerning scales them
+bool read_kerning_pairs(Font *font, const uint8_t *subtable, size_t length,
+                        const KernedGlyph *glyphs, int glyphs_count,
+                        int *kerning_size)
+{
+    if (length < 8) return true;
+
+    int pairs_count = read_big_endian_u16(subtable);
+    if (length < 8 + pairs_count * 6) pairs_count = (length - 8) / 6;
+
+    FT_Fixed x_scale = font->face->size->metrics.x_scale;
+    FT_UShort x_ppem = font->face->size->metrics.x_ppem;
+
+    for (int i = 0; i < pairs_count; ++i) {
+        const uint8_t *entry = subtable + 8 + i * 6;
+
+        int16_t value = read_big_endian_u16(entry + 4);
+        if (value == 0) continue;
+
+        FT_Pos x = FT_MulFix(value, x_scale);
+
+        // FreeType tones kerning down for small sizes
+        if (x_ppem < 25) x = FT_MulDiv(x, x_ppem, 25);
+
+        int amount = (x + 32) >> 6;
+        if (amount == 0) continue;
+
+        FT_UInt left_index = read_big_endian_u16(entry);
+        FT_UInt right_index = read_big_endian_u16(entry + 2);
+
+        int right_first = find_kerned_glyph(glyphs, glyphs_count, right_index);
+
+        for (int left = find_kerned_glyph(glyphs, glyphs_count, left_index);
+             left < glyphs_count && glyphs[left].index == left_index; ++left) {
+            for (int right = right_first;
+                 right < glyphs_count && glyphs[right].index == right_index;
+                 ++right) {
+                uint32_t pair = glyphs[left].codepoint << 16 |
+                                glyphs[right].codepoint;
+
+                if (!add_kerning_pair(font, kerning_size, pair, amount)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+// Fills in the kerning table from the font's 'kern' table, read once rather
+// than asking FreeType about every pair of codepoints. Like FT_Get_Kerning,
+// it only reads horizontal format 0 subtables, and not GPOS.
+bool load_kerning(Font *font)
+{
+    font->kerning = NULL;
+    font->kerning_count = 0;
+
+    FT_Face face = font->face;
+
+    if (!FT_HAS_KERNING(face)) return true;
+
+    // Every codepoint in the ranges that the font has a glyph for
+    KernedGlyph glyphs[MAX_KERNED_CODEPOINTS];
+    int glyphs_count = 0;
+
+    int ranges_count = sizeof(kerning_ranges) / sizeof(kerning_ranges[0]);
+
+    for (int i = 0; i < ranges_count; ++i) {
+        for (uint32_t codepoint = kerning_ranges[i][0];
+             codepoint <= kerning_ranges[i][1]; ++codepoint) {
+            FT_UInt index = FT_Get_Char_Index(face, codepoint);
+            if (!index) continue;
+
+            if (glyphs_count == MAX_KERNED_CODEPOINTS) {
+                fprintf(stderr, "load_kerning: more than %d codepoints in "
+                                "kerning_ranges\n",
+                        MAX_KERNED_CODEPOINTS);
+                return false;
+            }
+
+            glyphs[glyphs_count++] = (KernedGlyph){index, codepoint};
+        }
+    }
+
+    qsort(glyphs, glyphs_count, sizeof(*glyphs), compare_kerned_glyphs);
+
+    FT_ULong length = 0;
+    if (FT_Load_Sfnt_Table(face, TTAG_kern, 0, NULL, &length) || length < 4) {
+        return true;
+    }
+
+    uint8_t *table = malloc(length);
+    if (!table) {
+        fprintf(stderr, "load_kerning: out of memory\n");
+        return false;
+    }
+
+    bool loaded = !FT_Load_Sfnt_Table(face, TTAG_kern, 0, table, &length);
+    if (!loaded) fprintf(stderr, "load_kerning: can't read 'kern'\n");
+
+    // Only version 0, as FreeType reads
+    int subtables_count = loaded && read_big_endian_u16(table) == 0
+                              ? read_big_endian_u16(table + 2)
+                              : 0;
+
+    int kerning_size = 0;
+    size_t offset = 4;
+
+    for (int i = 0; i < subtables_count && offset + 6 <= length; ++i) {
+        const uint8_t *subtable = table + offset;
+
+        size_t subtable_length = read_big_endian_u16(subtable + 2);
+        uint16_t coverage = read_big_endian_u16(subtable + 4);
+
+        if (subtable_length < 6 || offset + subtable_length > length) break;
+
+        offset += subtable_length;
+
+        // Horizontal, not minimum values or cross stream, format 0
+        if ((coverage & 0xFF07) != 0x0001) continue;
+
+        if (!read_kerning_pairs(font, subtable + 6, subtable_length - 6,
+                                glyphs, glyphs_count, &kerning_size)) {
+            loaded = false;
+            break;
+        }
+    }
+
+    free(table);
+
+    if (!loaded) {
+        free(font->kerning);
+        font->kerning = NULL;
+        font->kerning_count = 0;
+
+        return false;
+    }
+
+    qsort(font->kerning, font->kerning_count, sizeof(*font->kerning),
+          compare_kerning_pairs);
+
+    // Subtables add up, so merge any pair in more than one
+    int merged = 0;
+
+    for (int i = 0; i < font->kerning_count; ++i) {
+        if (merged && font->kerning[merged - 1].pair == font->kerning[i].pair) {
+            font->kerning[merged - 1].amount += font->kerning[i].amount;
+        } else {
+            font->kerning[merged++] = font->kerning[i];
+        }
+    }
+
+    font->kerning_count = merged;
+
+    return true;
+}
+
+// Opens a font for rasterizing into page, which it can share with other
+// fonts of the same mode. FONT_SDF fonts are rasterized at point_size and
+// scaled when drawn.
+bool open_font(Font *font, AtlasPage *page, FT_Library freetype,
+               const char *filename, int point_size)
+{
+    // Kept in memory for the whole life of the font, so preload_glyphs can
+    // open more faces from it
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "open_font: can't open '%s'\n", filename);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    font->file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    font->file_data = malloc(font->file_size);
+    font->face = NULL;
+
+    bool read = font->file_data &&
+                fread(font->file_data, font->file_size, 1, file) == 1;
+
+    fclose(file);
+
+    if (!read) {
+        fprintf(stderr, "open_font: can't read '%s'\n", filename);
+        goto failed;
+    }
+
+    font->point_size = point_size;
+
+    FT_Error error = FT_New_Memory_Face(freetype, font->file_data,
+                                        font->file_size, 0, &font->face);
+    if (error) {
+        fprintf(stderr, "open_font: FT_New_Memory_Face '%s': %d\n", filename,
+                error);
+        font->face = NULL;
+        goto failed;
+    }
+
+    error = FT_Set_Char_Size(font->face, point_size * 64, 0, FONT_DPI, 0);
+    if (error) {
+        fprintf(stderr, "open_font: FT_Set_Char_Size: %d\n", error);
+        goto failed;
+    }
+
+    font->line_height = font->face->size->metrics.height >> 6;
+
+    if (!load_kerning(font)) goto failed;
+
+    memset(font->table, 0, sizeof(font->table));
+
+    add_font_to_page(page, font);
+
+    return true;
+
+failed:
+    if (font->face) FT_Done_Face(font->face);
+    free(font->file_data);
+
+    font->face = NULL;
+    font->file_data = NULL;
+
+    return false;
+}
+#endif
+
+// Writes the glyphs rasterized so far and the part of the page they use. The
+// font has to have its page to itself.
+bool save_baked_font(Font *font, const char *filename)
+{
+    AtlasPage *page = font->page;
+
+    if (page->fonts_count != 1) {
+        fprintf(stderr, "save_baked_font: the font's page is shared\n");
+        return false;
+    }
+
+    int used_height = 0;
+    for (int i = 0; i < page->glyphs_count; ++i) {
+        Glyph *glyph = &page->glyphs[i];
+
+        used_height =
+            max_int(used_height, glyph->texture_y + glyph->slot_height);
+    }
+
+    BakedFontHeader header = {0};
+    header.magic = BAKED_FONT_MAGIC;
+    header.version = BAKED_FONT_VERSION;
+    header.mode = page->mode;
+    header.glyph_bytes = sizeof(Glyph);
+    header.table_size = GLYPH_TABLE_SIZE;
+    header.glyphs_count = page->glyphs_count;
+    header.kerning_count = font->kerning_count;
+    header.texture_width = page->texture_width;
+    header.texture_height = round_up_to_power_of_two(max_int(used_height, 1));
+    header.line_height = font->line_height;
+
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        fprintf(stderr, "save_baked_font: can't open '%s'\n", filename);
+        return false;
+    }
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(font->table, sizeof(font->table), 1, file);
+
+    for (int i = 0; i < page->glyphs_count; ++i) {
+        Glyph glyph = page->glyphs[i];
+        glyph.last_used = 0;
+        glyph.pins = 0;
+
+        fwrite(&glyph, sizeof(glyph), 1, file);
+    }
+
+    fwrite(font->kerning, sizeof(*font->kerning), font->kerning_count, file);
+
+    fwrite(page->pixels, header.texture_width, header.texture_height, file);
+
+    bool written = !ferror(file);
+
+    fclose(file);
+
+    if (!written) {
+        fprintf(stderr, "save_baked_font: error writing '%s'\n", filename);
+    }
+
+    return written;
+}
+
+#ifndef FONT_NO_GL
+// Creates the page's texture from the pixels rasterized or loaded so far
+bool create_atlas_texture(AtlasPage *page)
+{
+    page->upload = malloc(page->texture_width * page->texture_height);
+    if (!page->upload) {
+        fprintf(stderr, "create_atlas_texture: out of memory\n");
+        return false;
+    }
+
+    glGenTextures(1, &page->texture);
+
+    bind_texture(0, page->texture);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, page->texture_width,
+                 page->texture_height, 0, GL_ALPHA, GL_UNSIGNED_BYTE,
+                 page->pixels);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    page->dirty_count = 0;
+
+    return true;
+}
+
+bool create_atlas_page(AtlasPage *page, FontMode mode)
+{
+    return init_atlas_page(page, mode) && create_atlas_texture(page);
+}
+
+// Frees whatever of the page init_atlas_page and create_atlas_texture made
+void free_atlas_page(AtlasPage *page)
+{
+    free(page->pixels);
+    free(page->upload);
+    page->pixels = NULL;
+    page->upload = NULL;
+
+    if (page->texture) delete_texture(page->texture);
+    page->texture = 0;
+}
+
+// Loads a font written by save_baked_font into an unused page. It has no
+// face to rasterize more glyphs from, so codepoints that weren't baked
+// aren't drawn.
+bool load_baked_font(Font *font, AtlasPage *page, const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        fprintf(stderr, "load_baked_font: can't open '%s'\n", filename);
+        return false;
+    }
+
+    BakedFontHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != BAKED_FONT_MAGIC ||
+        header.version != BAKED_FONT_VERSION ||
+        header.mode >= FONT_MODES_COUNT ||
+        header.glyph_bytes != sizeof(Glyph) ||
+        header.table_size != GLYPH_TABLE_SIZE ||
+        header.glyphs_count > MAX_GLYPHS ||
+        header.texture_width != FONT_ATLAS_SIZE ||
+        header.texture_height > FONT_ATLAS_SIZE) {
+        fprintf(stderr, "load_baked_font: '%s' isn't a compatible font\n",
+                filename);
+        fclose(file);
+        return false;
+    }
+
+    // Every page is the same size, so the shaders only need the one
+    if (!init_atlas_page(page, header.mode)) {
+        fclose(file);
+        return false;
+    }
+
+    page->fixed = true;
+    page->glyphs_count = header.glyphs_count;
+
+    font->line_height = header.line_height;
+    font->kerning_count = header.kerning_count;
+    font->kerning = malloc(max_int(font->kerning_count, 1) *
+                           sizeof(*font->kerning));
+    if (!font->kerning) {
+        fprintf(stderr, "load_baked_font: out of memory\n");
+        fclose(file);
+        return false;
+    }
+
+    bool read =
+        fread(font->table, sizeof(font->table), 1, file) == 1 &&
+        fread(page->glyphs, sizeof(Glyph), page->glyphs_count, file) ==
+            (size_t)page->glyphs_count &&
+        fread(font->kerning, sizeof(KerningPair), font->kerning_count,
+              file) == (size_t)font->kerning_count &&
+        fread(page->pixels, page->texture_width, header.texture_height,
+              file) == (size_t)header.texture_height;
+
+    fclose(file);
+
+    if (!read) {
+        fprintf(stderr, "load_baked_font: '%s' is truncated\n", filename);
+        return false;
+    }
+
+#ifndef TEXT_BAKED_FONT
+    font->face = NULL;
+#endif
+
+    add_font_to_page(page, font);
+
+    // The page is full as far as the packer is concerned
+    page->skyline[0].y = page->texture_height;
+
+    return create_atlas_texture(page);
+}
+#endif
+
+// Starts a new frame. Glyphs used from here on are safe from eviction until
+// the next call.
+void begin_atlas_frame(AtlasPage *page)
+{
+    ++page->frame;
+}
+
+// Returns the glyph for codepoint, rasterizing it if it isn't on the font's
+// page. Returns NULL if it couldn't be rasterized or there's no room for it.
+Glyph *get_glyph(Font *font, uint32_t codepoint)
+{
+    Glyph *glyph = find_glyph(font, codepoint);
+
+#ifndef TEXT_BAKED_FONT
+    if (!glyph && font->face) glyph = rasterize_glyph(font, codepoint);
+#endif
+
+    if (glyph) glyph->last_used = font->page->frame;
+
+    return glyph;
+}
+
+// Keeps glyph on its page, at the same place, until it's unpinned as many
+// times, for callers that hold on to its texture coordinates across frames.
+void pin_glyph(Glyph *glyph)
+{
+    ++glyph->pins;
+}
+
+void unpin_glyph(Glyph *glyph)
+{
+    assert(glyph->pins > 0);
+    --glyph->pins;
+}
+
+#ifndef FONT_NO_GL
+// Uploads the parts of the page that changed since the last flush. GLES2
+// can't upload a sub-rectangle of a wider image, so each one is copied out
+// row by row first.
+void flush_atlas_page(AtlasPage *page)
+{
+    if (page->dirty_count == 0) return;
+
+    bind_texture(0, page->texture);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (int i = 0; i < page->dirty_count; ++i) {
+        Rect *rect = &page->dirty[i];
+
+        const uint8_t *data =
+            page->pixels + rect->y * page->texture_width + rect->x;
+
+        if (rect->width != page->texture_width) {
+            for (int row = 0; row < rect->height; ++row) {
+                memcpy(page->upload + row * rect->width,
+                       data + row * page->texture_width, rect->width);
+            }
+
+            data = page->upload;
+        }
+
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect->x, rect->y, rect->width,
+                        rect->height, GL_ALPHA, GL_UNSIGNED_BYTE, data);
+
+        page->bytes_uploaded += rect->width * rect->height;
+    }
+
+    page->dirty_count = 0;
+}
+#endif
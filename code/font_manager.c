@@ -0,0 +1,180 @@
+// Loads fonts in any number of faces and sizes and hands out handles to
+// them. Fonts of the same mode share an atlas page until it holds
+// MAX_PAGE_FONTS of them, so text in several fonts comes from one texture and
+// can go out in one draw call. Baked fonts get a page each.
+
+#define MAX_FONTS 16
+#define MAX_ATLAS_PAGES 4
+#define NO_FONT -1
+
+typedef int FontHandle;
+
+typedef struct FontManager
+{
+#ifndef TEXT_BAKED_FONT
+    FT_Library freetype;
+#endif
+    AtlasPage pages[MAX_ATLAS_PAGES];
+    int pages_count;
+
+    Font fonts[MAX_FONTS];
+    int fonts_count;
+} FontManager;
+
+bool create_font_manager(FontManager *manager)
+{
+    manager->pages_count = 0;
+    manager->fonts_count = 0;
+
+#ifndef TEXT_BAKED_FONT
+    FT_Error error = FT_Init_FreeType(&manager->freetype);
+    if (error) {
+        fprintf(stderr, "create_font_manager: FT_Init_FreeType: %d\n", error);
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+Font *get_font(FontManager *manager, FontHandle handle)
+{
+    assert(handle >= 0 && handle < manager->fonts_count);
+
+    return &manager->fonts[handle];
+}
+
+AtlasPage *add_atlas_page(FontManager *manager)
+{
+    if (manager->pages_count == MAX_ATLAS_PAGES) {
+        fprintf(stderr, "add_atlas_page: no more than %d pages\n",
+                MAX_ATLAS_PAGES);
+        return NULL;
+    }
+
+    AtlasPage *page = &manager->pages[manager->pages_count];
+    memset(page, 0, sizeof(*page));
+    page->index = manager->pages_count;
+
+    ++manager->pages_count;
+
+    return page;
+}
+
+// Takes back the page add_atlas_page last handed out, for when the font it
+// was for didn't load
+void remove_atlas_page(FontManager *manager)
+{
+    free_atlas_page(&manager->pages[--manager->pages_count]);
+}
+
+Font *add_manager_font(FontManager *manager)
+{
+    if (manager->fonts_count == MAX_FONTS) {
+        fprintf(stderr, "add_manager_font: no more than %d fonts\n",
+                MAX_FONTS);
+        return NULL;
+    }
+
+    Font *font = &manager->fonts[manager->fonts_count++];
+    memset(font, 0, sizeof(*font));
+
+    return font;
+}
+
+#ifndef TEXT_BAKED_FONT
+// The page a new font in mode should go on, which is a new one if none of
+// the others have room
+AtlasPage *find_shared_page(FontManager *manager, FontMode mode)
+{
+    for (int i = 0; i < manager->pages_count; ++i) {
+        AtlasPage *page = &manager->pages[i];
+
+        if (page->mode == mode && !page->fixed &&
+            page->fonts_count < MAX_PAGE_FONTS) {
+            return page;
+        }
+    }
+
+    AtlasPage *page = add_atlas_page(manager);
+    if (!page) return NULL;
+
+    if (!create_atlas_page(page, mode)) {
+        remove_atlas_page(manager);
+        return NULL;
+    }
+
+    return page;
+}
+
+FontHandle add_font(FontManager *manager, const char *filename,
+                    int point_size, FontMode mode)
+{
+    int pages_count = manager->pages_count;
+
+    AtlasPage *page = find_shared_page(manager, mode);
+    if (!page) return NO_FONT;
+
+    Font *font = add_manager_font(manager);
+
+    if (!font ||
+        !open_font(font, page, manager->freetype, filename, point_size)) {
+        if (font) --manager->fonts_count;
+
+        // Don't leave a page made for this font behind, empty
+        if (manager->pages_count > pages_count) remove_atlas_page(manager);
+
+        return NO_FONT;
+    }
+
+    return manager->fonts_count - 1;
+}
+
+// Rasterizes ranges of codepoints in every font that can rasterize more, so
+// they're on their pages before the first frame
+void preload_fonts(FontManager *manager, JobSystem *jobs,
+                   const uint32_t ranges[][2], int ranges_count)
+{
+    for (int i = 0; i < manager->fonts_count; ++i) {
+        Font *font = &manager->fonts[i];
+
+        if (font->face) preload_glyphs(font, jobs, ranges, ranges_count);
+    }
+}
+#endif
+
+FontHandle add_baked_font(FontManager *manager, const char *filename)
+{
+    AtlasPage *page = add_atlas_page(manager);
+    if (!page) return NO_FONT;
+
+    Font *font = add_manager_font(manager);
+    if (!font) {
+        remove_atlas_page(manager);
+        return NO_FONT;
+    }
+
+    if (!load_baked_font(font, page, filename)) {
+        --manager->fonts_count;
+        remove_atlas_page(manager);
+        return NO_FONT;
+    }
+
+    return manager->fonts_count - 1;
+}
+
+void begin_fonts_frame(FontManager *manager)
+{
+    for (int i = 0; i < manager->pages_count; ++i) {
+        begin_atlas_frame(&manager->pages[i]);
+    }
+}
+
+// Uploads the glyphs rasterized since the last flush, before anything using
+// them is drawn
+void flush_fonts(FontManager *manager)
+{
+    for (int i = 0; i < manager->pages_count; ++i) {
+        flush_atlas_page(&manager->pages[i]);
+    }
+}
@@ -1,3 +1,17 @@
+#include <string.h>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+// WebGL2 builds get GLES3 for uniform buffers
+#ifdef USE_WEBGL2
+#include <GLES3/gl3.h>
+#endif
+
+#ifdef HEADLESS
+#include <EGL/egl.h>
+#endif
+
 GLuint create_shader_program(GLuint vertex_shader, GLuint fragment_shader)
 {
     GLuint program = glCreateProgram();
@@ -115,3 +129,798 @@ bool link_shader_program(GLuint program)
 
     return true;
 }
+
+// Shadows the state that's bound most often, so binding what's already
+// bound never reaches GL, which under WebGL saves a trip out of wasm and
+// through WebGL's validation. It starts out matching a new context, where
+// everything is 0 and every attribute is disabled, and only stays right if
+// every bind goes through these and every delete through the delete_*
+// functions, as GL reuses deleted names. Call reset_gl_state_cache after
+// anything else changes the bindings.
+
+#define MAX_CACHED_TEXTURE_UNITS 8
+#define MAX_CACHED_ATTRIBUTES 8
+#define GL_STATE_UNKNOWN 0xFFFFFFFFu
+
+typedef struct GLStateCache
+{
+    GLuint program;
+    GLuint framebuffer;
+    GLuint array_buffer;
+    GLuint element_array_buffer;
+    GLuint active_texture_unit;
+    GLuint textures[MAX_CACHED_TEXTURE_UNITS];
+    uint32_t enabled_attributes;
+    bool attributes_unknown;
+    GLuint vertex_array;
+
+    // The element buffer and enabled attributes belong to the bound vertex
+    // array, so the default one's are put aside while another is bound
+    GLuint default_element_array_buffer;
+    uint32_t default_enabled_attributes;
+    bool default_attributes_unknown;
+
+    // Since reset_gl_state_counters, for measuring. Uniform uploads are
+    // counted apart from binds.
+    int calls_made;
+    int calls_saved;
+    int uniforms_set;
+    int uniforms_saved;
+} GLStateCache;
+
+static GLStateCache gl_state;
+
+// Forgets everything, so the next bind of anything goes through
+void reset_gl_state_cache()
+{
+    gl_state.program = GL_STATE_UNKNOWN;
+    gl_state.framebuffer = GL_STATE_UNKNOWN;
+    gl_state.array_buffer = GL_STATE_UNKNOWN;
+    gl_state.element_array_buffer = GL_STATE_UNKNOWN;
+    gl_state.active_texture_unit = GL_STATE_UNKNOWN;
+
+    for (int i = 0; i < MAX_CACHED_TEXTURE_UNITS; ++i) {
+        gl_state.textures[i] = GL_STATE_UNKNOWN;
+    }
+
+    gl_state.attributes_unknown = true;
+    gl_state.vertex_array = GL_STATE_UNKNOWN;
+
+    gl_state.default_element_array_buffer = GL_STATE_UNKNOWN;
+    gl_state.default_attributes_unknown = true;
+}
+
+// Call once a frame to count that frame's calls
+void reset_gl_state_counters()
+{
+    gl_state.calls_made = 0;
+    gl_state.calls_saved = 0;
+    gl_state.uniforms_set = 0;
+    gl_state.uniforms_saved = 0;
+}
+
+// Whether a call setting *cached to value is needed, updating the shadow
+bool gl_state_changes(GLuint *cached, GLuint value)
+{
+    if (*cached == value) {
+        ++gl_state.calls_saved;
+        return false;
+    }
+
+    *cached = value;
+    ++gl_state.calls_made;
+    return true;
+}
+
+void use_program(GLuint program)
+{
+    if (gl_state_changes(&gl_state.program, program)) glUseProgram(program);
+}
+
+void bind_framebuffer(GLuint framebuffer)
+{
+    if (gl_state_changes(&gl_state.framebuffer, framebuffer)) {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    }
+}
+
+// target is GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER
+void bind_buffer(GLenum target, GLuint buffer)
+{
+    GLuint *cached = target == GL_ELEMENT_ARRAY_BUFFER ?
+                         &gl_state.element_array_buffer :
+                         &gl_state.array_buffer;
+
+    if (gl_state_changes(cached, buffer)) glBindBuffer(target, buffer);
+}
+
+// Makes unit the active texture unit, for anything that works on the active
+// unit's texture
+void set_active_texture(int unit)
+{
+    assert(unit < MAX_CACHED_TEXTURE_UNITS);
+
+    if (gl_state_changes(&gl_state.active_texture_unit, unit)) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+}
+
+// Binds a GL_TEXTURE_2D texture to unit, which is left active
+void bind_texture(int unit, GLuint texture)
+{
+    set_active_texture(unit);
+
+    if (gl_state_changes(&gl_state.textures[unit], texture)) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+    }
+}
+
+// Enables exactly the attribute locations set in mask. Counts a call saved
+// for each one that was already enabled.
+void set_enabled_attributes(uint32_t mask)
+{
+    assert(mask < 1u << MAX_CACHED_ATTRIBUTES);
+
+    uint32_t changed = gl_state.attributes_unknown ?
+                           (1u << MAX_CACHED_ATTRIBUTES) - 1 :
+                           gl_state.enabled_attributes ^ mask;
+
+    gl_state.calls_saved += __builtin_popcount(mask & ~changed);
+
+    for (GLuint location = 0; location < MAX_CACHED_ATTRIBUTES; ++location) {
+        if (!(changed & 1u << location)) continue;
+
+        if (mask & 1u << location) {
+            glEnableVertexAttribArray(location);
+        } else {
+            glDisableVertexAttribArray(location);
+        }
+
+        ++gl_state.calls_made;
+    }
+
+    gl_state.enabled_attributes = mask;
+    gl_state.attributes_unknown = false;
+}
+
+void enable_attribute(GLuint location)
+{
+    uint32_t bit = 1u << location;
+
+    if (!gl_state.attributes_unknown && gl_state.enabled_attributes & bit) {
+        ++gl_state.calls_saved;
+        return;
+    }
+
+    set_enabled_attributes(gl_state.enabled_attributes | bit);
+}
+
+void disable_attribute(GLuint location)
+{
+    uint32_t bit = 1u << location;
+
+    if (!gl_state.attributes_unknown && !(gl_state.enabled_attributes & bit)) {
+        ++gl_state.calls_saved;
+        return;
+    }
+
+    set_enabled_attributes(gl_state.enabled_attributes & ~bit);
+}
+
+void delete_buffer(GLuint buffer)
+{
+    if (gl_state.array_buffer == buffer) gl_state.array_buffer = 0;
+    if (gl_state.element_array_buffer == buffer) {
+        gl_state.element_array_buffer = 0;
+    }
+
+    glDeleteBuffers(1, &buffer);
+}
+
+void delete_texture(GLuint texture)
+{
+    for (int i = 0; i < MAX_CACHED_TEXTURE_UNITS; ++i) {
+        if (gl_state.textures[i] == texture) gl_state.textures[i] = 0;
+    }
+
+    glDeleteTextures(1, &texture);
+}
+
+void delete_framebuffer(GLuint framebuffer)
+{
+    if (gl_state.framebuffer == framebuffer) gl_state.framebuffer = 0;
+
+    glDeleteFramebuffers(1, &framebuffer);
+}
+
+// A linked program with its active uniforms and attributes looked up once,
+// into tables keyed by a hash of their names, so setting a uniform by name
+// never asks GL for a location. Each uniform keeps the last value set, and
+// setting the same one again is counted as a call saved rather than made.
+// Uniform arrays only have their first element cached.
+//
+// With USE_WEBGL2, uniform blocks are looked up too, and bind_uniform_block
+// points one at a UniformBuffer several programs can share.
+
+#define MAX_PROGRAM_UNIFORMS 32
+#define MAX_PROGRAM_ATTRIBUTES 8
+#define MAX_PROGRAM_BLOCKS 4
+#define PROGRAM_TABLE_SIZE 64
+#define MAX_PROGRAM_NAME 32
+#define MAX_UNIFORM_BYTES (16 * sizeof(float))
+
+typedef struct ProgramUniform
+{
+    char name[MAX_PROGRAM_NAME];
+    uint32_t hash;
+    GLint location;
+    GLenum type;
+    bool set;
+    uint8_t value[MAX_UNIFORM_BYTES];
+} ProgramUniform;
+
+typedef struct ProgramAttribute
+{
+    char name[MAX_PROGRAM_NAME];
+    uint32_t hash;
+    GLint location;
+} ProgramAttribute;
+
+#ifdef USE_WEBGL2
+typedef struct ProgramBlock
+{
+    char name[MAX_PROGRAM_NAME];
+    uint32_t hash;
+    GLuint index;
+    GLint size;
+} ProgramBlock;
+#endif
+
+typedef struct Program
+{
+    GLuint object;
+
+    ProgramUniform uniforms[MAX_PROGRAM_UNIFORMS];
+    int uniforms_count;
+
+    ProgramAttribute attributes[MAX_PROGRAM_ATTRIBUTES];
+    int attributes_count;
+
+    // Open addressing, each entry an index into the array above plus one, or
+    // 0 for none
+    uint8_t uniform_table[PROGRAM_TABLE_SIZE];
+    uint8_t attribute_table[PROGRAM_TABLE_SIZE];
+
+#ifdef USE_WEBGL2
+    ProgramBlock blocks[MAX_PROGRAM_BLOCKS];
+    int blocks_count;
+#endif
+} Program;
+
+uint32_t hash_program_name(const char *name)
+{
+    uint32_t hash = 0x811C9DC5u;
+
+    while (*name) hash = (hash ^ (uint8_t)*name++) * 0x01000193u;
+
+    return hash;
+}
+
+void insert_program_entry(uint8_t *table, uint32_t hash, int index)
+{
+    int bucket = hash & (PROGRAM_TABLE_SIZE - 1);
+
+    while (table[bucket]) bucket = (bucket + 1) & (PROGRAM_TABLE_SIZE - 1);
+
+    table[bucket] = index + 1;
+}
+
+// Copies a name GL reported, without the [0] it puts after arrays
+bool copy_program_name(char *out, const char *name, GLsizei length)
+{
+    if (length > 3 && strcmp(name + length - 3, "[0]") == 0) length -= 3;
+
+    if (length >= MAX_PROGRAM_NAME) {
+        fprintf(stderr, "copy_program_name: '%s' is too long\n", name);
+        return false;
+    }
+
+    memcpy(out, name, length);
+    out[length] = '\0';
+
+    return true;
+}
+
+bool reflect_uniforms(Program *program)
+{
+    GLint count;
+    glGetProgramiv(program->object, GL_ACTIVE_UNIFORMS, &count);
+
+    for (GLint i = 0; i < count; ++i) {
+        char name[MAX_PROGRAM_NAME + 3];
+        GLsizei length;
+        GLint size;
+        GLenum type;
+
+        glGetActiveUniform(program->object, i, sizeof(name), &length, &size,
+                           &type, name);
+
+        GLint location = glGetUniformLocation(program->object, name);
+
+        // Members of uniform blocks have no location of their own
+        if (location < 0) continue;
+
+        if (program->uniforms_count == MAX_PROGRAM_UNIFORMS) {
+            fprintf(stderr, "reflect_uniforms: more than %d uniforms\n",
+                    MAX_PROGRAM_UNIFORMS);
+            return false;
+        }
+
+        ProgramUniform *uniform = &program->uniforms[program->uniforms_count];
+
+        if (!copy_program_name(uniform->name, name, length)) return false;
+
+        uniform->hash = hash_program_name(uniform->name);
+        uniform->location = location;
+        uniform->type = type;
+        uniform->set = false;
+
+        insert_program_entry(program->uniform_table, uniform->hash,
+                             program->uniforms_count++);
+    }
+
+    return true;
+}
+
+bool reflect_attributes(Program *program)
+{
+    GLint count;
+    glGetProgramiv(program->object, GL_ACTIVE_ATTRIBUTES, &count);
+
+    if (count > MAX_PROGRAM_ATTRIBUTES) {
+        fprintf(stderr, "reflect_attributes: more than %d attributes\n",
+                MAX_PROGRAM_ATTRIBUTES);
+        return false;
+    }
+
+    for (GLint i = 0; i < count; ++i) {
+        char name[MAX_PROGRAM_NAME + 3];
+        GLsizei length;
+        GLint size;
+        GLenum type;
+
+        glGetActiveAttrib(program->object, i, sizeof(name), &length, &size,
+                          &type, name);
+
+        ProgramAttribute *attribute =
+            &program->attributes[program->attributes_count];
+
+        if (!copy_program_name(attribute->name, name, length)) return false;
+
+        attribute->hash = hash_program_name(attribute->name);
+        attribute->location = glGetAttribLocation(program->object, name);
+
+        insert_program_entry(program->attribute_table, attribute->hash,
+                             program->attributes_count++);
+    }
+
+    return true;
+}
+
+#ifdef USE_WEBGL2
+bool reflect_uniform_blocks(Program *program)
+{
+    GLint count;
+    glGetProgramiv(program->object, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+
+    if (count > MAX_PROGRAM_BLOCKS) {
+        fprintf(stderr, "reflect_uniform_blocks: more than %d blocks\n",
+                MAX_PROGRAM_BLOCKS);
+        return false;
+    }
+
+    for (GLint i = 0; i < count; ++i) {
+        ProgramBlock *block = &program->blocks[program->blocks_count++];
+        char name[MAX_PROGRAM_NAME];
+        GLsizei length;
+
+        glGetActiveUniformBlockName(program->object, i, sizeof(name), &length,
+                                    name);
+
+        if (!copy_program_name(block->name, name, length)) return false;
+
+        block->hash = hash_program_name(block->name);
+        block->index = i;
+
+        glGetActiveUniformBlockiv(program->object, i,
+                                  GL_UNIFORM_BLOCK_DATA_SIZE, &block->size);
+    }
+
+    return true;
+}
+#endif
+
+// Looks up everything active in object, which has to be linked already
+bool reflect_program(Program *program, GLuint object)
+{
+    memset(program, 0, sizeof(*program));
+    program->object = object;
+
+    if (!reflect_uniforms(program) || !reflect_attributes(program)) {
+        return false;
+    }
+
+#ifdef USE_WEBGL2
+    if (!reflect_uniform_blocks(program)) return false;
+#endif
+
+    return true;
+}
+
+// Links object, which takes its attribute locations from any
+// glBindAttribLocation calls made before, and looks up everything active in
+// it. Returns false if it doesn't link.
+bool link_program(Program *program, GLuint object)
+{
+    return link_shader_program(object) && reflect_program(program, object);
+}
+
+// Returns NULL for a uniform the program doesn't use, which setting is then
+// quietly skipped for, as GL does for location -1
+ProgramUniform *find_uniform(Program *program, const char *name)
+{
+    uint32_t hash = hash_program_name(name);
+
+    for (int bucket = hash & (PROGRAM_TABLE_SIZE - 1);
+         program->uniform_table[bucket];
+         bucket = (bucket + 1) & (PROGRAM_TABLE_SIZE - 1)) {
+        ProgramUniform *uniform =
+            &program->uniforms[program->uniform_table[bucket] - 1];
+
+        if (uniform->hash == hash && strcmp(uniform->name, name) == 0) {
+            return uniform;
+        }
+    }
+
+    return NULL;
+}
+
+// Returns -1 for an attribute the program doesn't use
+GLint get_attribute_location(Program *program, const char *name)
+{
+    uint32_t hash = hash_program_name(name);
+
+    for (int bucket = hash & (PROGRAM_TABLE_SIZE - 1);
+         program->attribute_table[bucket];
+         bucket = (bucket + 1) & (PROGRAM_TABLE_SIZE - 1)) {
+        ProgramAttribute *attribute =
+            &program->attributes[program->attribute_table[bucket] - 1];
+
+        if (attribute->hash == hash && strcmp(attribute->name, name) == 0) {
+            return attribute->location;
+        }
+    }
+
+    return -1;
+}
+
+// Finds the uniform and makes the program current if value differs from the
+// last one set, for the setters below to upload it
+ProgramUniform *change_uniform(Program *program, const char *name,
+                               const void *value, size_t bytes)
+{
+    assert(bytes <= MAX_UNIFORM_BYTES);
+
+    ProgramUniform *uniform = find_uniform(program, name);
+    if (!uniform) return NULL;
+
+    if (uniform->set && memcmp(uniform->value, value, bytes) == 0) {
+        ++gl_state.uniforms_saved;
+        return NULL;
+    }
+
+    memcpy(uniform->value, value, bytes);
+    uniform->set = true;
+    ++gl_state.uniforms_set;
+
+    use_program(program->object);
+
+    return uniform;
+}
+
+// For int and bool uniforms and samplers, which take a texture unit
+void set_uniform_int(Program *program, const char *name, GLint value)
+{
+    ProgramUniform *uniform =
+        change_uniform(program, name, &value, sizeof(value));
+
+    if (uniform) glUniform1i(uniform->location, value);
+}
+
+void set_uniform_float(Program *program, const char *name, float value)
+{
+    ProgramUniform *uniform =
+        change_uniform(program, name, &value, sizeof(value));
+
+    if (uniform) glUniform1f(uniform->location, value);
+}
+
+void set_uniform_vec2(Program *program, const char *name, float x, float y)
+{
+    float value[] = {x, y};
+
+    ProgramUniform *uniform =
+        change_uniform(program, name, value, sizeof(value));
+
+    if (uniform) glUniform2fv(uniform->location, 1, value);
+}
+
+void set_uniform_vec4(Program *program, const char *name, float x, float y,
+                      float z, float w)
+{
+    float value[] = {x, y, z, w};
+
+    ProgramUniform *uniform =
+        change_uniform(program, name, value, sizeof(value));
+
+    if (uniform) glUniform4fv(uniform->location, 1, value);
+}
+
+// matrix is 16 floats, column major
+void set_uniform_mat4(Program *program, const char *name,
+                      const float *matrix)
+{
+    ProgramUniform *uniform =
+        change_uniform(program, name, matrix, 16 * sizeof(*matrix));
+
+    if (uniform) glUniformMatrix4fv(uniform->location, 1, GL_FALSE, matrix);
+}
+
+#ifdef USE_WEBGL2
+// A buffer backing a uniform block at a binding point. The data last
+// uploaded is kept, so updating it with the same data costs nothing.
+typedef struct UniformBuffer
+{
+    GLuint buffer;
+    GLuint binding;
+    int size;
+    uint8_t *data;
+} UniformBuffer;
+
+bool create_uniform_buffer(UniformBuffer *buffer, GLuint binding, int size)
+{
+    buffer->data = calloc(1, size);
+    if (!buffer->data) {
+        fprintf(stderr, "create_uniform_buffer: out of memory\n");
+        return false;
+    }
+
+    buffer->binding = binding;
+    buffer->size = size;
+
+    glGenBuffers(1, &buffer->buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer->buffer);
+    glBufferData(GL_UNIFORM_BUFFER, size, buffer->data, GL_DYNAMIC_DRAW);
+
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer->buffer);
+
+    return true;
+}
+
+void delete_uniform_buffer(UniformBuffer *buffer)
+{
+    glDeleteBuffers(1, &buffer->buffer);
+    free(buffer->data);
+}
+
+// Points the program's block called name at the buffer
+bool bind_uniform_block(Program *program, const char *name,
+                        const UniformBuffer *buffer)
+{
+    uint32_t hash = hash_program_name(name);
+
+    for (int i = 0; i < program->blocks_count; ++i) {
+        ProgramBlock *block = &program->blocks[i];
+
+        if (block->hash != hash || strcmp(block->name, name) != 0) continue;
+
+        if (block->size > buffer->size) {
+            fprintf(stderr, "bind_uniform_block: '%s' needs %d bytes\n",
+                    name, block->size);
+            return false;
+        }
+
+        glUniformBlockBinding(program->object, block->index, buffer->binding);
+        return true;
+    }
+
+    fprintf(stderr, "bind_uniform_block: no block '%s'\n", name);
+    return false;
+}
+
+// Uploads bytes of data to the start of the buffer, unless they're what's
+// there already
+void update_uniform_buffer(UniformBuffer *buffer, const void *data,
+                           int bytes)
+{
+    assert(bytes <= buffer->size);
+
+    if (memcmp(buffer->data, data, bytes) == 0) {
+        ++gl_state.uniforms_saved;
+        return;
+    }
+
+    memcpy(buffer->data, data, bytes);
+    ++gl_state.uniforms_set;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer->buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, bytes, data);
+}
+#endif
+
+void *get_gl_proc_address(const char *name)
+{
+#ifdef HEADLESS
+    return (void *)eglGetProcAddress(name);
+#else
+    return SDL_GL_GetProcAddress(name);
+#endif
+}
+
+bool has_gl_extension(const char *name)
+{
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+
+    return extensions && strstr(extensions, name);
+}
+
+// Entry points for instanced drawing. WebGL1 exposes them through
+// ANGLE_instanced_arrays, GLES2 drivers through the EXT or NV extensions and
+// GLES3 has them in core.
+typedef struct Instancing
+{
+    PFNGLVERTEXATTRIBDIVISORANGLEPROC vertex_attrib_divisor;
+    PFNGLDRAWARRAYSINSTANCEDANGLEPROC draw_arrays_instanced;
+} Instancing;
+
+bool load_instancing(Instancing *instancing)
+{
+    const char *suffix = NULL;
+
+    if (has_gl_extension("ANGLE_instanced_arrays")) {
+        suffix = "ANGLE";
+    } else if (has_gl_extension("EXT_instanced_arrays")) {
+        suffix = "EXT";
+    } else if (has_gl_extension("NV_instanced_arrays")) {
+        suffix = "NV";
+    } else if (strstr((const char *)glGetString(GL_VERSION),
+                      "OpenGL ES 3") != NULL) {
+        suffix = "";
+    } else {
+        fprintf(stderr, "load_instancing: instanced arrays not supported\n");
+        return false;
+    }
+
+    char name[64];
+
+    snprintf(name, sizeof(name), "glVertexAttribDivisor%s", suffix);
+    instancing->vertex_attrib_divisor =
+        (PFNGLVERTEXATTRIBDIVISORANGLEPROC)get_gl_proc_address(name);
+
+    snprintf(name, sizeof(name), "glDrawArraysInstanced%s", suffix);
+    instancing->draw_arrays_instanced =
+        (PFNGLDRAWARRAYSINSTANCEDANGLEPROC)get_gl_proc_address(name);
+
+    if (!instancing->vertex_attrib_divisor ||
+        !instancing->draw_arrays_instanced) {
+        fprintf(stderr, "load_instancing: couldn't load %s entry points\n",
+                suffix);
+        return false;
+    }
+
+    return true;
+}
+
+// Entry points for vertex array objects, which hold a mesh's attribute
+// layout so it can be bound in one call. WebGL1 exposes them through
+// OES_vertex_array_object and GLES3 has them in core. They stay NULL until
+// load_vertex_array_objects finds them.
+typedef struct VertexArrayObjects
+{
+    PFNGLGENVERTEXARRAYSOESPROC gen_vertex_arrays;
+    PFNGLBINDVERTEXARRAYOESPROC bind_vertex_array;
+    PFNGLDELETEVERTEXARRAYSOESPROC delete_vertex_arrays;
+} VertexArrayObjects;
+
+static VertexArrayObjects gl_vertex_arrays;
+
+// Returns false if there are none, in which case everything drawn keeps
+// using the default vertex array
+bool load_vertex_array_objects()
+{
+    const char *suffix = NULL;
+
+    if (has_gl_extension("OES_vertex_array_object")) {
+        suffix = "OES";
+    } else if (strstr((const char *)glGetString(GL_VERSION),
+                      "OpenGL ES 3") != NULL) {
+        suffix = "";
+    } else {
+        return false;
+    }
+
+    char name[64];
+
+    snprintf(name, sizeof(name), "glGenVertexArrays%s", suffix);
+    gl_vertex_arrays.gen_vertex_arrays =
+        (PFNGLGENVERTEXARRAYSOESPROC)get_gl_proc_address(name);
+
+    snprintf(name, sizeof(name), "glBindVertexArray%s", suffix);
+    gl_vertex_arrays.bind_vertex_array =
+        (PFNGLBINDVERTEXARRAYOESPROC)get_gl_proc_address(name);
+
+    snprintf(name, sizeof(name), "glDeleteVertexArrays%s", suffix);
+    gl_vertex_arrays.delete_vertex_arrays =
+        (PFNGLDELETEVERTEXARRAYSOESPROC)get_gl_proc_address(name);
+
+    if (!gl_vertex_arrays.gen_vertex_arrays ||
+        !gl_vertex_arrays.bind_vertex_array ||
+        !gl_vertex_arrays.delete_vertex_arrays) {
+        fprintf(stderr,
+                "load_vertex_array_objects: couldn't load %s entry points\n",
+                suffix);
+        memset(&gl_vertex_arrays, 0, sizeof(gl_vertex_arrays));
+        return false;
+    }
+
+    return true;
+}
+
+bool has_vertex_array_objects()
+{
+    return gl_vertex_arrays.bind_vertex_array != NULL;
+}
+
+GLuint create_vertex_array_object()
+{
+    GLuint vertex_array;
+
+    gl_vertex_arrays.gen_vertex_arrays(1, &vertex_array);
+
+    return vertex_array;
+}
+
+// Binds a vertex array object, or the default vertex array for 0. Binding
+// anything else does nothing without vertex array objects.
+void bind_vertex_array_object(GLuint vertex_array)
+{
+    if (!has_vertex_array_objects()) return;
+
+    GLuint previous = gl_state.vertex_array;
+
+    if (!gl_state_changes(&gl_state.vertex_array, vertex_array)) return;
+
+    gl_vertex_arrays.bind_vertex_array(vertex_array);
+
+    if (previous == 0) {
+        gl_state.default_element_array_buffer = gl_state.element_array_buffer;
+        gl_state.default_enabled_attributes = gl_state.enabled_attributes;
+        gl_state.default_attributes_unknown = gl_state.attributes_unknown;
+    }
+
+    if (vertex_array == 0) {
+        gl_state.element_array_buffer = gl_state.default_element_array_buffer;
+        gl_state.enabled_attributes = gl_state.default_enabled_attributes;
+        gl_state.attributes_unknown = gl_state.default_attributes_unknown;
+    } else {
+        gl_state.element_array_buffer = GL_STATE_UNKNOWN;
+        gl_state.attributes_unknown = true;
+    }
+}
+
+void delete_vertex_array_object(GLuint vertex_array)
+{
+    if (gl_state.vertex_array == vertex_array) bind_vertex_array_object(0);
+
+    gl_vertex_arrays.delete_vertex_arrays(1, &vertex_array);
+}
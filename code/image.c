@@ -0,0 +1,40 @@
+// Loads an image file with SDL_image into a new RGBA texture. Returns 0 on
+// failure. The texture is left bound to GL_TEXTURE_2D.
+GLuint load_texture(const char *filename, GLint filter)
+{
+    SDL_Surface *surface = IMG_Load(filename);
+
+    if (!surface) {
+        fprintf(stderr, "load_texture: IMG_Load '%s': %s\n", filename,
+                IMG_GetError());
+        return 0;
+    }
+
+    if (surface->format->format != SDL_PIXELFORMAT_RGBA32) {
+        SDL_Surface *converted_surface =
+            SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_RGBA32, 0);
+        assert(converted_surface);
+
+        SDL_FreeSurface(surface);
+
+        surface = converted_surface;
+    }
+
+    GLuint texture;
+
+    glGenTextures(1, &texture);
+
+    bind_texture(0, texture);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, surface->w, surface->h, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, surface->pixels);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    SDL_FreeSurface(surface);
+
+    return texture;
+}
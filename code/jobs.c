@@ -0,0 +1,273 @@
+// A small work-stealing job system on top of pthreads (Web Workers when built
+// with emcc -pthread).
+//
+// run_parallel_for splits a range into chunks and deals them out across the
+// workers' queues. Each worker pops from the back of its own queue and, when
+// that runs dry, steals from the front of someone else's. The calling thread
+// takes part as worker 0 and only returns once every chunk has finished, so
+// callers can treat it as a parallel loop with an implicit join. Built with
+// emcc but without -pthread there is only worker 0, and every chunk runs
+// serially on the calling thread.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/threading.h>
+#endif
+
+#define MAX_WORKERS 16
+#define JOB_QUEUE_SIZE 1024
+
+// Called with the worker's index so jobs can keep per-worker scratch state
+typedef void (*JobFunction)(void *user_data, int begin, int end, int worker);
+
+typedef struct Job
+{
+    JobFunction function;
+    void *user_data;
+    int begin;
+    int end;
+} Job;
+
+typedef struct JobQueue
+{
+    pthread_mutex_t mutex;
+    Job jobs[JOB_QUEUE_SIZE];
+    int front;
+    int back;
+} JobQueue;
+
+typedef struct JobSystem JobSystem;
+
+typedef struct Worker
+{
+    JobSystem *system;
+    pthread_t thread;
+    int index;
+} Worker;
+
+struct JobSystem
+{
+    Worker workers[MAX_WORKERS];
+    JobQueue queues[MAX_WORKERS];
+    int workers_count;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    atomic_int pending;
+    bool quit;
+};
+
+int count_cores()
+{
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    return 1;
+#elif defined(__EMSCRIPTEN__)
+    return emscripten_num_logical_cores();
+#else
+    return sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+bool push_job(JobQueue *queue, Job job)
+{
+    pthread_mutex_lock(&queue->mutex);
+
+    bool pushed = queue->back - queue->front < JOB_QUEUE_SIZE;
+    if (pushed) {
+        queue->jobs[queue->back % JOB_QUEUE_SIZE] = job;
+        ++queue->back;
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+
+    return pushed;
+}
+
+// The owner takes the most recently pushed job
+bool pop_job(JobQueue *queue, Job *job)
+{
+    pthread_mutex_lock(&queue->mutex);
+
+    bool popped = queue->back > queue->front;
+    if (popped) {
+        --queue->back;
+        *job = queue->jobs[queue->back % JOB_QUEUE_SIZE];
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+
+    return popped;
+}
+
+// Thieves take the oldest job, which is furthest from what the owner is
+// working on
+bool steal_job(JobQueue *queue, Job *job)
+{
+    pthread_mutex_lock(&queue->mutex);
+
+    bool stolen = queue->back > queue->front;
+    if (stolen) {
+        *job = queue->jobs[queue->front % JOB_QUEUE_SIZE];
+        ++queue->front;
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+
+    return stolen;
+}
+
+bool find_job(JobSystem *system, int worker, Job *job)
+{
+    if (pop_job(&system->queues[worker], job)) return true;
+
+    for (int i = 1; i < system->workers_count; ++i) {
+        int victim = (worker + i) % system->workers_count;
+
+        if (steal_job(&system->queues[victim], job)) return true;
+    }
+
+    return false;
+}
+
+// Runs jobs until there are none left anywhere
+void work(JobSystem *system, int worker)
+{
+    Job job;
+
+    while (atomic_load(&system->pending) > 0) {
+        if (find_job(system, worker, &job)) {
+            job.function(job.user_data, job.begin, job.end, worker);
+            atomic_fetch_sub(&system->pending, 1);
+        } else {
+            // Remaining jobs are already running on other workers
+            sched_yield();
+        }
+    }
+}
+
+void *worker_main(void *user_data)
+{
+    Worker *worker = (Worker *)user_data;
+    JobSystem *system = worker->system;
+
+    for (;;) {
+        pthread_mutex_lock(&system->mutex);
+
+        while (!system->quit && atomic_load(&system->pending) == 0) {
+            pthread_cond_wait(&system->wake, &system->mutex);
+        }
+
+        bool quit = system->quit;
+
+        pthread_mutex_unlock(&system->mutex);
+
+        if (quit) break;
+
+        work(system, worker->index);
+    }
+
+    return NULL;
+}
+
+// Starts workers_count - 1 threads; the calling thread is worker 0
+bool start_job_system(JobSystem *system, int workers_count)
+{
+    if (workers_count < 1) workers_count = 1;
+    if (workers_count > MAX_WORKERS) workers_count = MAX_WORKERS;
+
+    system->workers_count = workers_count;
+    system->quit = false;
+    atomic_init(&system->pending, 0);
+
+    pthread_mutex_init(&system->mutex, NULL);
+    pthread_cond_init(&system->wake, NULL);
+
+    for (int i = 0; i < workers_count; ++i) {
+        JobQueue *queue = &system->queues[i];
+
+        pthread_mutex_init(&queue->mutex, NULL);
+        queue->front = 0;
+        queue->back = 0;
+
+        Worker *worker = &system->workers[i];
+
+        worker->system = system;
+        worker->index = i;
+    }
+
+    for (int i = 1; i < workers_count; ++i) {
+        Worker *worker = &system->workers[i];
+
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            fprintf(stderr,
+                    "start_job_system: pthread_create failed, using %d "
+                    "workers\n",
+                    i);
+            system->workers_count = i;
+            break;
+        }
+    }
+
+    return true;
+}
+
+void stop_job_system(JobSystem *system)
+{
+    pthread_mutex_lock(&system->mutex);
+    system->quit = true;
+    pthread_cond_broadcast(&system->wake);
+    pthread_mutex_unlock(&system->mutex);
+
+    for (int i = 1; i < system->workers_count; ++i) {
+        pthread_join(system->workers[i].thread, NULL);
+    }
+
+    // Stopping again is then harmless
+    system->workers_count = 1;
+}
+
+// Calls function on [0, count) in chunks of chunk_size and waits for all of
+// them to finish.
+void run_parallel_for(JobSystem *system, int count, int chunk_size,
+                      JobFunction function, void *user_data)
+{
+    if (count <= 0) return;
+
+    int chunks_count = (count + chunk_size - 1) / chunk_size;
+
+    // Nobody to share with, so run the chunks in order here
+    if (system->workers_count == 1 || chunks_count == 1) {
+        for (int begin = 0; begin < count; begin += chunk_size) {
+            int end = begin + chunk_size < count ? begin + chunk_size : count;
+
+            function(user_data, begin, end, 0);
+        }
+        return;
+    }
+
+    atomic_fetch_add(&system->pending, chunks_count);
+
+    for (int i = 0; i < chunks_count; ++i) {
+        Job job;
+        job.function = function;
+        job.user_data = user_data;
+        job.begin = i * chunk_size;
+        job.end = job.begin + chunk_size < count ? job.begin + chunk_size :
+                                                   count;
+
+        if (!push_job(&system->queues[i % system->workers_count], job)) {
+            // Queue is full, so run it here rather than drop it
+            function(user_data, job.begin, job.end, 0);
+            atomic_fetch_sub(&system->pending, 1);
+        }
+    }
+
+    pthread_mutex_lock(&system->mutex);
+    pthread_cond_broadcast(&system->wake);
+    pthread_mutex_unlock(&system->mutex);
+
+    work(system, 0);
+}
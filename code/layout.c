@@ -0,0 +1,161 @@
+// Lays text out into positioned glyphs in one pass: kerning, newlines and
+// wrapping at spaces to a width. The result only depends on the text and the
+// font's metrics, so it can be kept and drawn every frame until the text
+// changes.
+//
+// Positions are the top left of each glyph's quad, relative to the top left
+// of the text. Glyphs with nothing to draw, like spaces, take up room but
+// aren't in the layout. Each keeps its Glyph, which stays valid until the
+// page's generation changes.
+
+typedef struct LaidOutGlyph
+{
+    uint32_t codepoint;
+    Glyph *glyph;
+    float x;
+    float y;
+} LaidOutGlyph;
+
+typedef struct TextLayout
+{
+    LaidOutGlyph *glyphs;
+    int glyphs_count;
+    int glyphs_size;
+    float scale;
+    float width;
+    float height;
+    int lines_count;
+
+    // The page's generation when the glyphs were looked up
+    unsigned generation;
+} TextLayout;
+
+bool add_laid_out_glyph(TextLayout *layout, Glyph *glyph, float x, float y)
+{
+    if (layout->glyphs_count == layout->glyphs_size) {
+        int glyphs_size = max_int(layout->glyphs_size * 2, 64);
+
+        LaidOutGlyph *glyphs =
+            realloc(layout->glyphs, glyphs_size * sizeof(*glyphs));
+        if (!glyphs) {
+            fprintf(stderr, "add_laid_out_glyph: out of memory\n");
+            return false;
+        }
+
+        layout->glyphs = glyphs;
+        layout->glyphs_size = glyphs_size;
+    }
+
+    LaidOutGlyph *laid_out = &layout->glyphs[layout->glyphs_count++];
+    laid_out->codepoint = glyph->codepoint;
+    laid_out->glyph = glyph;
+    laid_out->x = x;
+    laid_out->y = y;
+
+    return true;
+}
+
+// Lays s out at scale, wrapping lines that would be wider than wrap_width, or
+// not at all if it's 0. A word too long for a line of its own is broken
+// wherever it runs out of room. The layout's glyphs are reused, so a layout
+// can be laid out again without allocating.
+bool layout_text(TextLayout *layout, Font *font, const char *s, float scale,
+                 float wrap_width)
+{
+    float line_height = font->line_height * scale;
+
+    layout->glyphs_count = 0;
+    layout->scale = scale;
+    layout->width = 0;
+    layout->lines_count = 1;
+
+    float pen_x = 0;
+    float pen_y = 0;
+    uint32_t previous = 0;
+
+    // Where the line can be broken: just after the last space on it, and
+    // how wide the line is up to that space
+    int break_glyph = -1;
+    float break_x = 0;
+    float break_width = 0;
+
+    while (*s) {
+        uint32_t codepoint = decode_utf8(&s);
+
+        if (codepoint == '\n') {
+            layout->width = max_float(layout->width, pen_x);
+
+            pen_x = 0;
+            pen_y += line_height;
+            previous = 0;
+            break_glyph = -1;
+            ++layout->lines_count;
+            continue;
+        }
+
+        Glyph *glyph = get_glyph(font, codepoint);
+        if (!glyph) continue;
+
+        if (previous) pen_x += get_kerning(font, previous, codepoint) * scale;
+
+        // Wrap if the glyph would go past the edge
+        float right = pen_x + (glyph->bearing_x + glyph->width) * scale;
+
+        if (wrap_width > 0 && right > wrap_width && pen_x > 0 &&
+            codepoint != ' ') {
+            float shift;
+
+            if (break_glyph >= 0) {
+                // Move the word so far down to the next line
+                layout->width = max_float(layout->width, break_width);
+                shift = break_x;
+
+                for (int i = break_glyph; i < layout->glyphs_count; ++i) {
+                    layout->glyphs[i].x -= shift;
+                    layout->glyphs[i].y += line_height;
+                }
+            } else {
+                layout->width = max_float(layout->width, pen_x);
+                shift = pen_x;
+            }
+
+            pen_x -= shift;
+            pen_y += line_height;
+            break_glyph = -1;
+            ++layout->lines_count;
+        }
+
+        if (glyph->width > 0 && glyph->height > 0) {
+            float x = pen_x + glyph->bearing_x * scale;
+            float y = pen_y + (font->line_height - glyph->bearing_y) * scale;
+
+            if (!add_laid_out_glyph(layout, glyph, x, y)) return false;
+        }
+
+        if (codepoint == ' ') {
+            break_glyph = layout->glyphs_count;
+            break_width = pen_x;
+            break_x = pen_x + glyph->advance * scale;
+        }
+
+        pen_x += glyph->advance * scale;
+        previous = codepoint;
+    }
+
+    layout->width = max_float(layout->width, pen_x);
+    layout->height = pen_y + line_height;
+
+    // Glyphs laid out this frame can't be evicted by the later ones
+    layout->generation = font->page->generation;
+
+    return true;
+}
+
+void free_text_layout(TextLayout *layout)
+{
+    free(layout->glyphs);
+
+    layout->glyphs = NULL;
+    layout->glyphs_count = 0;
+    layout->glyphs_size = 0;
+}
@@ -10,3 +10,18 @@ uint32_t round_up_to_power_of_two(uint32_t v)
 
     return v;
 }
+
+int min_int(int a, int b)
+{
+    return a < b ? a : b;
+}
+
+int max_int(int a, int b)
+{
+    return a > b ? a : b;
+}
+
+float max_float(float a, float b)
+{
+    return a > b ? a : b;
+}
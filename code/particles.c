@@ -3,65 +3,557 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-#include <emscripten.h>
-#include <emscripten/html5.h>
+#include <SDL2/SDL_image.h>
 
+#include "platform.c"
 #include "sdl.c"
 #include "gl.c"
+#include "stream.c"
+#include "vertex_format.c"
+#include "image.c"
 #include "timing.c"
+#include "simd.c"
+#include "jobs.c"
+#include "random.c"
 
 #define POSITION_ATTRIBUTE_LOCATION 0
-#define COLOUR_ATTRIBUTE_LOCATION 1
-#define POSITION_ATTRIBUTE_SIZE 4
-#define COLOUR_ATTRIBUTE_SIZE 4
-#define PARTICLE_FLOATS (POSITION_ATTRIBUTE_SIZE + COLOUR_ATTRIBUTE_SIZE)
-#define PARTICLE_BYTES ((PARTICLE_FLOATS) * sizeof(float))
+#define SPAWN_TIME_ATTRIBUTE_LOCATION 1
+#define COLOUR_ATTRIBUTE_LOCATION 2
+#define CORNER_ATTRIBUTE_LOCATION 3
+#define SIZE_ATTRIBUTE_LOCATION 4
+#define POSITION_BYTES (2 * sizeof(int16_t))
+#define COLOUR_BYTES (sizeof(uint32_t))
+#define SIZE_BYTES (sizeof(float))
+#define PARTICLE_BYTES (POSITION_BYTES + COLOUR_BYTES + SIZE_BYTES)
+#define GPU_PARTICLE_BYTES (sizeof(GpuParticle))
+// Uploaded positions are divided by this so they fit in a normalized short
+#define POSITION_SCALE 2.0f
 #define ONE_SECOND 1000.0
 #define PARTICLE_SPEED 0.002f
+#define PARTICLE_MIN_Y -1.1f
+#define PARTICLE_MAX_Y 1.0f
+#define PARTICLE_MIN_SIZE 4.0f
+#define PARTICLE_MAX_SIZE 24.0f
+#define SPRITE_TEXTURE_SIZE 32
 #define NEW_PARTICLES_PER_FRAME 1000
+#define PARTICLE_CHUNK_SIZE 8192
+#define SPAWN_CHUNK_SIZE 256
+#define DEFAULT_SEED 1
+
+typedef enum Simulation
+{
+    SIMULATION_CPU,
+    SIMULATION_GPU,
+} Simulation;
 
 typedef struct Renderer
 {
     GLuint program;
     GLuint buffer_object;
+    StreamBuffer stream;
+    VertexFormat position_format;
+    VertexFormat colour_format;
+    VertexFormat size_format;
+    VertexFormat gpu_format;
+    GLint time_location;
+
+    // Instanced sprites instead of points, CPU simulation only
+    bool instanced;
+    Instancing instancing;
+    GLuint quad_buffer;
+    GLuint sprite;
 } Renderer;
 
+// Structure-of-arrays particle store. Each attribute lives in its own stream
+// so the update kernel only touches the data it needs and the streams can be
+// uploaded to the GPU without re-interleaving.
+typedef struct Particles
+{
+    float *x;
+    float *y;
+    float *velocity;
+    uint32_t *colour;
+    float *diameter;
+    int *dead;
+    int count;
+    int size;
+    bool stable_order;
+} Particles;
+
+// Particles for the GPU simulation. Each one is written once when it spawns
+// (spawn time, x and colour) and the vertex shader works out where it is now,
+// so only new particles are uploaded. The buffer is a ring: the oldest
+// particles are always the ones that get overwritten.
+typedef struct GpuParticle
+{
+    float spawn_time;
+    int16_t x;
+    int16_t padding;
+    uint32_t colour;
+} GpuParticle;
+
+typedef struct ParticleRing
+{
+    GpuParticle *spawned;
+    int head;
+    int count;
+    int size;
+} ParticleRing;
+
+// State shared by the jobs of one CPU simulation step. Particles are updated
+// and compacted within each chunk, then the survivors of every chunk are
+// gathered into the spare store at offsets from a prefix sum of the counts.
+typedef struct CpuStep
+{
+    Particles *particles;
+    Particles *spare;
+    int *survivors;
+    int *offsets;
+    int16_t *positions;
+    float dt;
+    int spawn_begin;
+    uint64_t seed;
+} CpuStep;
+
 typedef struct Globals
 {
     SDL sdl;
     Renderer renderer;
     Timing timing;
-    float *particles;
+    JobSystem jobs;
+    Simulation simulation;
+    Particles particles;
+    Particles spare;
+    int *chunk_survivors;
+    int *chunk_offsets;
+    unsigned int frame;
+    uint64_t seed;
+    Random random;
+    ParticleRing ring;
+    double start_time;
     int window_width;
     int window_height;
-    double frame_start_time;
-    double previous_frame_start_time;
-    int particles_count;
-    int particles_size;
 } Globals;
 
-void set_particle(float *particle, float x, float y, float r, float g, float b,
-                  float a)
+bool create_particles(Particles *particles, int size)
+{
+    particles->size = size;
+    particles->count = 0;
+    particles->x = malloc(size * sizeof(*particles->x));
+    particles->y = malloc(size * sizeof(*particles->y));
+    particles->velocity = malloc(size * sizeof(*particles->velocity));
+    particles->colour = malloc(size * sizeof(*particles->colour));
+    particles->diameter = malloc(size * sizeof(*particles->diameter));
+    particles->dead = malloc(size * sizeof(*particles->dead));
+
+    if (!particles->x || !particles->y || !particles->velocity ||
+        !particles->colour || !particles->diameter ||
+        !particles->dead) {
+        fprintf(stderr, "create_particles: out of memory\n");
+        return false;
+    }
+
+    return true;
+}
+
+void copy_particle(Particles *particles, int destination, int source)
+{
+    particles->x[destination] = particles->x[source];
+    particles->y[destination] = particles->y[source];
+    particles->velocity[destination] = particles->velocity[source];
+    particles->colour[destination] = particles->colour[source];
+    particles->diameter[destination] = particles->diameter[source];
+}
+
+void move_particles(Particles *particles, int destination, int source,
+                    int count)
+{
+    memmove(particles->x + destination, particles->x + source,
+            count * sizeof(*particles->x));
+    memmove(particles->y + destination, particles->y + source,
+            count * sizeof(*particles->y));
+    memmove(particles->velocity + destination, particles->velocity + source,
+            count * sizeof(*particles->velocity));
+    memmove(particles->colour + destination, particles->colour + source,
+            count * sizeof(*particles->colour));
+    memmove(particles->diameter + destination, particles->diameter + source,
+            count * sizeof(*particles->diameter));
+}
+
+// Copies count particles between stores, which must not overlap
+void gather_particles(Particles *destination, int destination_index,
+                      const Particles *source, int source_index, int count)
+{
+    memcpy(destination->x + destination_index, source->x + source_index,
+           count * sizeof(*source->x));
+    memcpy(destination->y + destination_index, source->y + source_index,
+           count * sizeof(*source->y));
+    memcpy(destination->velocity + destination_index,
+           source->velocity + source_index, count * sizeof(*source->velocity));
+    memcpy(destination->colour + destination_index,
+           source->colour + source_index, count * sizeof(*source->colour));
+    memcpy(destination->diameter + destination_index,
+           source->diameter + source_index, count * sizeof(*source->diameter));
+}
+
+// Spawns count particles from first onwards, drawing every x, colour and
+// diameter from random in bulk
+void spawn_particles(Particles *particles, int first, int count,
+                     Random *random)
+{
+    float *x = particles->x + first;
+    float *y = particles->y + first;
+    float *velocity = particles->velocity + first;
+    uint32_t *colour = particles->colour + first;
+    float *diameter = particles->diameter + first;
+
+    fill_uniform_floats(random, x, count);
+    fill_uniform_u32(random, colour, count);
+    fill_uniform_floats(random, diameter, count);
+
+    uint32_t opaque = pack_colour(0, 0, 0, 0xFF);
+
+    for (int i = 0; i < count; ++i) {
+        x[i] = x[i] * 2.0f - 1.0f;
+        y[i] = PARTICLE_MIN_Y;
+        velocity[i] = PARTICLE_SPEED;
+        colour[i] |= opaque;
+        diameter[i] = PARTICLE_MIN_SIZE +
+                      diameter[i] * (PARTICLE_MAX_SIZE - PARTICLE_MIN_SIZE);
+    }
+}
+
+void update_particles(Particles *particles, int begin, int end, float dt)
+{
+    float *y = particles->y;
+    float *velocity = particles->velocity;
+
+    simd_float step = simd_splat(dt);
+
+    int i = begin;
+    for (; i + SIMD_WIDTH <= end; i += SIMD_WIDTH) {
+        simd_float position = simd_load(y + i);
+        simd_float speed = simd_load(velocity + i);
+
+        simd_store(y + i, simd_add(position, simd_mul(speed, step)));
+    }
+
+    // Remainder that doesn't fill a whole vector
+    for (; i < end; ++i) {
+        y[i] += velocity[i] * dt;
+    }
+}
+
+// Removes dead particles from [begin, end) while keeping the survivors in
+// their original order, and returns the new end. Every particle is written to
+// the cursor and the cursor only advances for live ones, so there's no
+// per-particle branch. Whole vectors of live particles are moved as one block.
+int compact_particles_stable(Particles *particles, int begin, int end)
+{
+    float *y = particles->y;
+
+    simd_float limit = simd_splat(PARTICLE_MAX_Y);
+
+    int write = begin;
+    int i = begin;
+    for (; i + SIMD_WIDTH <= end; i += SIMD_WIDTH) {
+        int dead = simd_mask_gt(simd_load(y + i), limit);
+
+        if (dead == 0) {
+            if (write != i) move_particles(particles, write, i, SIMD_WIDTH);
+            write += SIMD_WIDTH;
+            continue;
+        }
+
+        for (int lane = 0; lane < SIMD_WIDTH; ++lane) {
+            copy_particle(particles, write, i + lane);
+            write += !((dead >> lane) & 1);
+        }
+    }
+
+    for (; i < end; ++i) {
+        int dead = y[i] > PARTICLE_MAX_Y;
+
+        copy_particle(particles, write, i);
+        write += !dead;
+    }
+
+    return write;
+}
+
+// Removes dead particles from [begin, end) by filling each hole with a live
+// particle from the tail, and returns the new end. This moves only as many
+// particles as died, but scrambles the order.
+int compact_particles_unstable(Particles *particles, int begin, int end)
+{
+    float *y = particles->y;
+    int *dead = particles->dead + begin;
+    int count = end;
+
+    simd_float limit = simd_splat(PARTICLE_MAX_Y);
+
+    // Gather the indices of dead particles in ascending order
+    int dead_count = 0;
+    int i = begin;
+    for (; i + SIMD_WIDTH <= end; i += SIMD_WIDTH) {
+        int mask = simd_mask_gt(simd_load(y + i), limit);
+
+        for (int lane = 0; mask; ++lane, mask >>= 1) {
+            dead[dead_count] = i + lane;
+            dead_count += mask & 1;
+        }
+    }
+
+    for (; i < end; ++i) {
+        dead[dead_count] = i;
+        dead_count += y[i] > PARTICLE_MAX_Y;
+    }
+
+    int front = 0;
+    int back = dead_count;
+    while (front < back) {
+        --count;
+
+        if (count == dead[back - 1]) {
+            // The tail is dead itself, so just drop it
+            --back;
+        } else {
+            copy_particle(particles, dead[front], count);
+            ++front;
+        }
+    }
+
+    return count;
+}
+
+void update_chunk(void *user_data, int begin, int end, int worker)
+{
+    CpuStep *step = (CpuStep *)user_data;
+    Particles *particles = step->particles;
+
+    update_particles(particles, begin, end, step->dt);
+
+    int survivors_end = particles->stable_order ?
+                            compact_particles_stable(particles, begin, end) :
+                            compact_particles_unstable(particles, begin, end);
+
+    step->survivors[begin / PARTICLE_CHUNK_SIZE] = survivors_end - begin;
+}
+
+void gather_chunk(void *user_data, int begin, int end, int worker)
 {
-    particle[0] = x;
-    particle[1] = y;
-    particle[2] = 0; // z
-    particle[3] = 1; // w
+    CpuStep *step = (CpuStep *)user_data;
+    int chunk = begin / PARTICLE_CHUNK_SIZE;
 
-    particle[4] = r;
-    particle[5] = g;
-    particle[6] = b;
-    particle[7] = a;
+    gather_particles(step->spare, step->offsets[chunk], step->particles, begin,
+                     step->survivors[chunk]);
 }
 
-void spawn_particle(float *particle)
+void spawn_chunk(void *user_data, int begin, int end, int worker)
 {
-    float x = ((float)rand() / (float)(RAND_MAX / 2)) - 1.0f;
-    float y = -1.1f;
+    CpuStep *step = (CpuStep *)user_data;
 
-    set_particle(particle, x, y, (float)rand() / (float)(RAND_MAX),
-                 (float)rand() / (float)(RAND_MAX),
-                 (float)rand() / (float)(RAND_MAX), 1.0f);
+    // Seeded from the chunk rather than the worker, so a frame spawns the
+    // same particles however the chunks were shared out
+    Random random;
+    seed_random(&random, step->seed + begin);
+
+    spawn_particles(step->particles, step->spawn_begin + begin, end - begin,
+                    &random);
+}
+
+// Positions are packed to normalized shorts on the way out. Colours and sizes
+// are uploaded as they are.
+void pack_chunk(void *user_data, int begin, int end, int worker)
+{
+    CpuStep *step = (CpuStep *)user_data;
+    Particles *particles = step->particles;
+
+    int16_t *position = step->positions + (begin * 2);
+
+    for (int i = begin; i < end; ++i) {
+        position[0] = pack_snorm16(particles->x[i] / POSITION_SCALE);
+        position[1] = pack_snorm16(particles->y[i] / POSITION_SCALE);
+        position += 2;
+    }
+}
+
+// Returns false if the particles' vertices didn't fit in the stream, and
+// there's nothing to draw this frame
+bool simulate_on_cpu(Globals *globals, double dt)
+{
+    JobSystem *jobs = &globals->jobs;
+
+    CpuStep step = {0};
+    step.particles = &globals->particles;
+    step.spare = &globals->spare;
+    step.survivors = globals->chunk_survivors;
+    step.offsets = globals->chunk_offsets;
+    step.dt = dt;
+
+    // Update and compact each chunk
+    int count = globals->particles.count;
+
+    run_parallel_for(jobs, count, PARTICLE_CHUNK_SIZE, update_chunk, &step);
+
+    // Gather the survivors into the spare store, then swap the two
+    {
+        int chunks_count = (count + PARTICLE_CHUNK_SIZE - 1) /
+                           PARTICLE_CHUNK_SIZE;
+
+        int offset = 0;
+        for (int i = 0; i < chunks_count; ++i) {
+            step.offsets[i] = offset;
+            offset += step.survivors[i];
+        }
+
+        run_parallel_for(jobs, count, PARTICLE_CHUNK_SIZE, gather_chunk,
+                         &step);
+
+        Particles swap = globals->particles;
+        globals->particles = globals->spare;
+        globals->spare = swap;
+
+        globals->particles.count = offset;
+        globals->particles.stable_order = swap.stable_order;
+    }
+
+    Particles *particles = &globals->particles;
+    step.particles = particles;
+
+    // Spawn
+    {
+        int spawn_count = particles->size - particles->count;
+        if (spawn_count > NEW_PARTICLES_PER_FRAME) {
+            spawn_count = NEW_PARTICLES_PER_FRAME;
+        }
+
+        step.spawn_begin = particles->count;
+        step.seed = globals->seed ^ ((uint64_t)globals->frame << 32);
+
+        run_parallel_for(jobs, spawn_count, SPAWN_CHUNK_SIZE, spawn_chunk,
+                         &step);
+
+        particles->count += spawn_count;
+    }
+
+    Renderer *renderer = &globals->renderer;
+    StreamBuffer *stream = &renderer->stream;
+
+    stream_begin_frame(stream);
+
+    GLintptr position_offset, colour_offset, size_offset;
+
+    step.positions = stream_alloc(stream, particles->count * POSITION_BYTES,
+                                  &position_offset);
+    if (!step.positions) return false;
+
+    run_parallel_for(jobs, particles->count, PARTICLE_CHUNK_SIZE, pack_chunk,
+                     &step);
+
+    if (!stream_upload(stream, particles->colour,
+                       particles->count * COLOUR_BYTES, &colour_offset)) {
+        return false;
+    }
+
+    // Only sprites have a size of their own
+    if (renderer->instanced &&
+        !stream_upload(stream, particles->diameter,
+                       particles->count * SIZE_BYTES, &size_offset)) {
+        return false;
+    }
+
+    apply_vertex_format(&renderer->position_format, position_offset);
+    apply_vertex_format(&renderer->colour_format, colour_offset);
+
+    if (renderer->instanced) {
+        apply_vertex_format(&renderer->size_format, size_offset);
+    }
+
+    return true;
+}
+
+void simulate_on_gpu(Globals *globals, float time)
+{
+    ParticleRing *ring = &globals->ring;
+
+    float x[NEW_PARTICLES_PER_FRAME];
+    uint32_t colour[NEW_PARTICLES_PER_FRAME];
+
+    fill_uniform_floats(&globals->random, x, NEW_PARTICLES_PER_FRAME);
+    fill_uniform_u32(&globals->random, colour, NEW_PARTICLES_PER_FRAME);
+
+    uint32_t opaque = pack_colour(0, 0, 0, 0xFF);
+
+    GpuParticle *particle = ring->spawned;
+    for (int i = 0; i < NEW_PARTICLES_PER_FRAME; ++i) {
+        particle->spawn_time = time;
+        particle->x = pack_snorm16(x[i] * 2.0f - 1.0f);
+        particle->padding = 0;
+        particle->colour = colour[i] | opaque;
+        ++particle;
+    }
+
+    // Upload the new particles at the head, wrapping round at the end
+    int remaining = NEW_PARTICLES_PER_FRAME;
+    particle = ring->spawned;
+    while (remaining > 0) {
+        int space = ring->size - ring->head;
+        int count = remaining < space ? remaining : space;
+
+        glBufferSubData(GL_ARRAY_BUFFER, ring->head * GPU_PARTICLE_BYTES,
+                        count * GPU_PARTICLE_BYTES, particle);
+
+        ring->head = (ring->head + count) % ring->size;
+        particle += count;
+        remaining -= count;
+    }
+
+    ring->count += NEW_PARTICLES_PER_FRAME;
+    if (ring->count > ring->size) ring->count = ring->size;
+
+    glUniform1f(globals->renderer.time_location, time);
+}
+
+// Soft white disc, used when there's no sprite image to load
+GLuint create_sprite_texture()
+{
+    uint8_t *pixels = malloc(SPRITE_TEXTURE_SIZE * SPRITE_TEXTURE_SIZE * 4);
+
+    float radius = SPRITE_TEXTURE_SIZE / 2.0f;
+
+    uint8_t *pixel = pixels;
+    for (int y = 0; y < SPRITE_TEXTURE_SIZE; ++y) {
+        for (int x = 0; x < SPRITE_TEXTURE_SIZE; ++x) {
+            float dx = (x + 0.5f - radius) / radius;
+            float dy = (y + 0.5f - radius) / radius;
+            float falloff = 1.0f - (dx * dx + dy * dy);
+
+            pixel[0] = 0xFF;
+            pixel[1] = 0xFF;
+            pixel[2] = 0xFF;
+            pixel[3] = pack_unorm8(falloff);
+            pixel += 4;
+        }
+    }
+
+    GLuint texture;
+
+    glGenTextures(1, &texture);
+
+    bind_texture(0, texture);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SPRITE_TEXTURE_SIZE,
+                 SPRITE_TEXTURE_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    free(pixels);
+
+    return texture;
 }
 
 EM_BOOL main_loop(double time, void *user_data)
@@ -74,37 +566,18 @@ EM_BOOL main_loop(double time, void *user_data)
 
     SDL *sdl = &globals->sdl;
     if (sdl->keyboard_state[SDL_SCANCODE_Q]) {
+        stop_job_system(&globals->jobs);
         cleanup_sdl(sdl);
         return EM_FALSE;
     }
 
     // Update
-    {
-        float *particle = globals->particles;
-        int i = 0;
-        while (i < globals->particles_count) {
-            particle[1] += PARTICLE_SPEED * dt;
-
-            if (particle[1] > 1.0f) {
-                --globals->particles_count;
-
-                float *source = globals->particles +
-                                (globals->particles_count * PARTICLE_FLOATS);
-
-                memcpy(particle, source, PARTICLE_BYTES);
-            } else {
-                ++i;
-                particle += PARTICLE_FLOATS;
-            }
-        }
-
-        for (i = 0; i < NEW_PARTICLES_PER_FRAME; ++i) {
-            if (globals->particles_count == globals->particles_size) break;
-
-            spawn_particle(particle);
-            particle += PARTICLE_FLOATS;
-            ++globals->particles_count;
-        }
+    int count;
+    if (globals->simulation == SIMULATION_CPU) {
+        count = simulate_on_cpu(globals, dt) ? globals->particles.count : 0;
+    } else {
+        simulate_on_gpu(globals, time - globals->start_time);
+        count = globals->ring.count;
     }
 
     // Render
@@ -113,16 +586,18 @@ EM_BOOL main_loop(double time, void *user_data)
 
         glClear(GL_COLOR_BUFFER_BIT);
 
-        glBufferSubData(GL_ARRAY_BUFFER, 0,
-                        globals->particles_count * PARTICLE_BYTES,
-                        globals->particles);
-
-        glDrawArrays(GL_POINTS, 0, globals->particles_count);
+        if (renderer->instanced) {
+            renderer->instancing.draw_arrays_instanced(GL_TRIANGLE_STRIP, 0, 4,
+                                                       count);
+        } else {
+            glDrawArrays(GL_POINTS, 0, count);
+        }
 
-        SDL_GL_SwapWindow(sdl->window);
+        swap_sdl_window(sdl);
     }
 
     ++globals->timing.fps;
+    ++globals->frame;
 
     return EM_TRUE;
 }
@@ -134,37 +609,129 @@ int main(int argc, char *argv[])
     globals->window_width = 640;
     globals->window_height = 480;
 
+    globals->simulation = SIMULATION_CPU;
+    globals->seed = DEFAULT_SEED;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--gpu") == 0) {
+            globals->simulation = SIMULATION_GPU;
+        } else if (strcmp(argv[i], "--instanced") == 0) {
+            globals->renderer.instanced = true;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            globals->seed = strtoull(argv[++i], NULL, 0);
+        }
+    }
+
+    if (globals->simulation == SIMULATION_GPU && globals->renderer.instanced) {
+        fprintf(stderr, "main: --instanced needs the CPU simulation, using "
+                        "points\n");
+        globals->renderer.instanced = false;
+    }
+
+    seed_random(&globals->random, globals->seed);
+
     if (!setup_sdl(&globals->sdl, globals->window_width,
                    globals->window_height)) {
         cleanup_sdl(&globals->sdl);
         return 1;
     }
 
+    start_job_system(&globals->jobs, count_cores());
+
     // Setup Particles
     {
-        globals->particles_size = 200000;
-        globals->particles = malloc(globals->particles_size * PARTICLE_BYTES);
+        Particles *particles = &globals->particles;
+
+        int size = 200000;
+
+        if (!create_particles(particles, size) ||
+            !create_particles(&globals->spare, size)) {
+            return 1;
+        }
+
+        int chunks_count = (size + PARTICLE_CHUNK_SIZE - 1) /
+                           PARTICLE_CHUNK_SIZE;
+
+        globals->chunk_survivors =
+            malloc(chunks_count * sizeof(*globals->chunk_survivors));
+        globals->chunk_offsets =
+            malloc(chunks_count * sizeof(*globals->chunk_offsets));
+
+        // Keeping spawn order means the upload is the same sequence each frame
+        particles->stable_order = true;
+
+        ParticleRing *ring = &globals->ring;
+
+        ring->size = particles->size;
+        ring->spawned = malloc(NEW_PARTICLES_PER_FRAME * GPU_PARTICLE_BYTES);
     }
 
     // Setup Renderer
     {
         Renderer *renderer = &globals->renderer;
 
+        if (renderer->instanced && !load_instancing(&renderer->instancing)) {
+            fprintf(stderr, "main: falling back to points\n");
+            renderer->instanced = false;
+        }
+
         glEnable(GL_BLEND);
 
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-        const char vertex_shader_code[] = "uniform float point_size;\n"
-                                          "attribute vec4 position;\n"
-                                          "attribute vec4 colour;\n"
-                                          "varying vec4 varying_colour;\n"
-                                          "\n"
-                                          "void main()\n"
-                                          "{\n"
-                                          "    gl_Position = position;\n"
-                                          "    gl_PointSize = point_size;\n"
-                                          "    varying_colour = colour;\n"
-                                          "}";
+        const char cpu_vertex_shader_code[] =
+            "uniform float point_size;\n"
+            "uniform float position_scale;\n"
+            "attribute vec2 position;\n"
+            "attribute vec4 colour;\n"
+            "varying vec4 varying_colour;\n"
+            "\n"
+            "void main()\n"
+            "{\n"
+            "    gl_Position = vec4(position * position_scale, 0.0, 1.0);\n"
+            "    gl_PointSize = point_size;\n"
+            "    varying_colour = colour;\n"
+            "}";
+
+        // Dead particles are moved outside the clip volume so they're culled
+        const char gpu_vertex_shader_code[] =
+            "uniform float point_size;\n"
+            "uniform float time;\n"
+            "uniform float min_y;\n"
+            "uniform float max_y;\n"
+            "uniform float speed;\n"
+            "attribute float position_x;\n"
+            "attribute float spawn_time;\n"
+            "attribute vec4 colour;\n"
+            "varying vec4 varying_colour;\n"
+            "\n"
+            "void main()\n"
+            "{\n"
+            "    float y = min_y + (time - spawn_time) * speed;\n"
+            "    gl_Position = y > max_y ? vec4(2.0, 2.0, 2.0, 1.0) :\n"
+            "                              vec4(position_x, y, 0.0, 1.0);\n"
+            "    gl_PointSize = point_size;\n"
+            "    varying_colour = colour;\n"
+            "}";
+
+        // One unit quad per particle, scaled by the particle's size in pixels
+        const char sprite_vertex_shader_code[] =
+            "uniform vec2 pixel_size;\n"
+            "uniform float position_scale;\n"
+            "attribute vec2 corner;\n"
+            "attribute vec2 position;\n"
+            "attribute float size;\n"
+            "attribute vec4 colour;\n"
+            "varying vec4 varying_colour;\n"
+            "varying vec2 varying_tex_coord;\n"
+            "\n"
+            "void main()\n"
+            "{\n"
+            "    vec2 centre = position * position_scale;\n"
+            "    gl_Position =\n"
+            "        vec4(centre + corner * size * pixel_size, 0.0, 1.0);\n"
+            "    varying_tex_coord = corner + 0.5;\n"
+            "    varying_colour = colour;\n"
+            "}";
 
         const char fragment_shader_code[] =
             "precision mediump float;\n"
@@ -175,15 +742,42 @@ int main(int argc, char *argv[])
             "    gl_FragColor = varying_colour;\n"
             "}";
 
-        renderer->program = create_shader_program_from_code(
-            vertex_shader_code, fragment_shader_code);
+        const char sprite_fragment_shader_code[] =
+            "precision mediump float;\n"
+            "uniform sampler2D sampler;\n"
+            "varying vec4 varying_colour;\n"
+            "varying vec2 varying_tex_coord;\n"
+            "\n"
+            "void main()\n"
+            "{\n"
+            "    gl_FragColor =\n"
+            "        texture2D(sampler, varying_tex_coord) * varying_colour;\n"
+            "}";
+
+        if (renderer->instanced) {
+            renderer->program = create_shader_program_from_code(
+                sprite_vertex_shader_code, sprite_fragment_shader_code);
+        } else {
+            renderer->program = create_shader_program_from_code(
+                globals->simulation == SIMULATION_CPU ? cpu_vertex_shader_code :
+                                                        gpu_vertex_shader_code,
+                fragment_shader_code);
+        }
 
         if (renderer->program == 0) return false;
 
         glBindAttribLocation(renderer->program, POSITION_ATTRIBUTE_LOCATION,
-                             "position");
+                             globals->simulation == SIMULATION_CPU ?
+                                 "position" :
+                                 "position_x");
+        glBindAttribLocation(renderer->program, SPAWN_TIME_ATTRIBUTE_LOCATION,
+                             "spawn_time");
         glBindAttribLocation(renderer->program, COLOUR_ATTRIBUTE_LOCATION,
                              "colour");
+        glBindAttribLocation(renderer->program, CORNER_ATTRIBUTE_LOCATION,
+                             "corner");
+        glBindAttribLocation(renderer->program, SIZE_ATTRIBUTE_LOCATION,
+                             "size");
 
         if (!link_shader_program(renderer->program)) {
             return false;
@@ -191,7 +785,7 @@ int main(int argc, char *argv[])
 
         glReleaseShaderCompiler();
 
-        glUseProgram(renderer->program);
+        use_program(renderer->program);
 
         glClearColor(0.0, 0.0, 0.0, 1.0);
 
@@ -211,32 +805,130 @@ int main(int argc, char *argv[])
             glUniform1f(location, pointSize);
         }
 
+        glUniform1f(glGetUniformLocation(renderer->program, "position_scale"),
+                    POSITION_SCALE);
+
+        // Set motion uniforms for the GPU simulation
+        if (globals->simulation == SIMULATION_GPU) {
+            renderer->time_location =
+                glGetUniformLocation(renderer->program, "time");
+
+            glUniform1f(glGetUniformLocation(renderer->program, "min_y"),
+                        PARTICLE_MIN_Y);
+            glUniform1f(glGetUniformLocation(renderer->program, "max_y"),
+                        PARTICLE_MAX_Y);
+            glUniform1f(glGetUniformLocation(renderer->program, "speed"),
+                        PARTICLE_SPEED);
+        }
+
+        // Setup Sprites
+        if (renderer->instanced) {
+            glUniform2f(glGetUniformLocation(renderer->program, "pixel_size"),
+                        2.0f / globals->window_width,
+                        2.0f / globals->window_height);
+
+            glUniform1i(glGetUniformLocation(renderer->program, "sampler"), 0);
+
+            set_active_texture(0);
+
+            renderer->sprite =
+                load_texture("assets/images/particle.png", GL_LINEAR);
+
+            if (!renderer->sprite) {
+                renderer->sprite = create_sprite_texture();
+            }
+
+            // Shared by every instance, so it's the one attribute that
+            // advances per vertex
+            float corners[] = {
+                -0.5f, -0.5f,
+
+                0.5f,  -0.5f,
+
+                -0.5f, 0.5f,
+
+                0.5f,  0.5f,
+            };
+
+            glGenBuffers(1, &renderer->quad_buffer);
+            bind_buffer(GL_ARRAY_BUFFER, renderer->quad_buffer);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners,
+                         GL_STATIC_DRAW);
+
+            enable_attribute(CORNER_ATTRIBUTE_LOCATION);
+            glVertexAttribPointer(CORNER_ATTRIBUTE_LOCATION, 2, GL_FLOAT,
+                                  GL_FALSE, 0, 0);
+        }
+
         // Set up Vertex Buffer Object
-        {
+        if (globals->simulation == SIMULATION_CPU) {
+            // Each frame's x, y and colour streams are allocated back to back.
+            // Attribute pointers are set per frame as the offsets move.
+            int size = globals->particles.size * PARTICLE_BYTES +
+                       STREAM_ALIGNMENT * 4;
+
+            if (!create_stream_buffer(&renderer->stream, size, STREAM_RING)) {
+                return 1;
+            }
+
+            add_vertex_attribute(&renderer->position_format,
+                                 POSITION_ATTRIBUTE_LOCATION, 2, GL_SHORT,
+                                 GL_TRUE);
+
+            add_vertex_attribute(&renderer->colour_format,
+                                 COLOUR_ATTRIBUTE_LOCATION, 4, GL_UNSIGNED_BYTE,
+                                 GL_TRUE);
+
+            enable_vertex_format(&renderer->position_format);
+            enable_vertex_format(&renderer->colour_format);
+
+            if (renderer->instanced) {
+                add_vertex_attribute(&renderer->size_format,
+                                     SIZE_ATTRIBUTE_LOCATION, 1, GL_FLOAT,
+                                     GL_FALSE);
+
+                enable_vertex_format(&renderer->size_format);
+
+                Instancing *instancing = &renderer->instancing;
+
+                instancing->vertex_attrib_divisor(POSITION_ATTRIBUTE_LOCATION,
+                                                  1);
+                instancing->vertex_attrib_divisor(COLOUR_ATTRIBUTE_LOCATION, 1);
+                instancing->vertex_attrib_divisor(SIZE_ATTRIBUTE_LOCATION, 1);
+            }
+        } else {
             glGenBuffers(1, &renderer->buffer_object);
-            glBindBuffer(GL_ARRAY_BUFFER, renderer->buffer_object);
+            bind_buffer(GL_ARRAY_BUFFER, renderer->buffer_object);
 
             glBufferData(GL_ARRAY_BUFFER,
-                         globals->particles_size * PARTICLE_BYTES, NULL,
+                         globals->ring.size * GPU_PARTICLE_BYTES, NULL,
                          GL_DYNAMIC_DRAW);
 
-            glEnableVertexAttribArray(POSITION_ATTRIBUTE_LOCATION);
-            glEnableVertexAttribArray(COLOUR_ATTRIBUTE_LOCATION);
+            VertexFormat *format = &renderer->gpu_format;
+
+            add_vertex_attribute(format, SPAWN_TIME_ATTRIBUTE_LOCATION, 1,
+                                 GL_FLOAT, GL_FALSE);
+            add_vertex_attribute(format, POSITION_ATTRIBUTE_LOCATION, 1,
+                                 GL_SHORT, GL_TRUE);
+            add_vertex_attribute(format, COLOUR_ATTRIBUTE_LOCATION, 4,
+                                 GL_UNSIGNED_BYTE, GL_TRUE);
 
-            glVertexAttribPointer(POSITION_ATTRIBUTE_LOCATION,
-                                  POSITION_ATTRIBUTE_SIZE, GL_FLOAT, GL_FALSE,
-                                  PARTICLE_BYTES, 0);
+            assert(format->stride == GPU_PARTICLE_BYTES);
 
-            glVertexAttribPointer(
-                COLOUR_ATTRIBUTE_LOCATION, COLOUR_ATTRIBUTE_SIZE, GL_FLOAT,
-                GL_FALSE, PARTICLE_BYTES,
-                (const void *)(POSITION_ATTRIBUTE_SIZE * sizeof(float)));
+            enable_vertex_format(format);
+            apply_vertex_format(format, 0);
         }
     }
 
-    globals->timing.frame_start_time = emscripten_performance_now();
+    globals->timing.frame_start_time = get_time();
+    globals->start_time = globals->timing.frame_start_time;
+
+    run_frame_loop(main_loop, globals);
 
-    emscripten_request_animation_frame_loop(main_loop, globals);
+#ifndef __EMSCRIPTEN__
+    // Native frame loops return once they're done, so join the workers here
+    stop_job_system(&globals->jobs);
+#endif
 
     return 0;
 }
@@ -0,0 +1,232 @@
+// A frame's render passes, declared up front with the targets they draw to
+// and read from, then run in order by execute_pass_graph.
+//
+// Targets added with add_graph_target are transient: they only get a real
+// framebuffer from the pool when the first pass that draws to them runs,
+// and hand it back after the last pass that reads them, so later passes can
+// draw into it again. Passes whose output nothing reads are culled, along
+// with everything only they read, working back from GRAPH_SCREEN, the
+// default framebuffer.
+//
+// Declare the graph again every frame, between begin_pass_graph and
+// execute_pass_graph. Nothing in it is kept.
+
+#define MAX_GRAPH_PASSES 16
+#define MAX_GRAPH_TARGETS 16
+#define MAX_PASS_INPUTS 4
+#define GRAPH_SCREEN 0
+
+typedef int GraphTarget;
+
+typedef struct PassGraph PassGraph;
+typedef struct RenderPass RenderPass;
+
+// Called with the pass's output bound and its viewport set, and its inputs
+// bound to texture units 0 up in the order they were added
+typedef void (*PassFunction)(PassGraph *graph, RenderPass *pass,
+                             void *user_data);
+
+typedef struct PassInput
+{
+    GraphTarget target;
+    GLint filter;
+} PassInput;
+
+struct RenderPass
+{
+    const char *name;
+    PassFunction function;
+    void *user_data;
+    GraphTarget output;
+    PassInput inputs[MAX_PASS_INPUTS];
+    int inputs_count;
+    bool culled;
+};
+
+typedef struct GraphTargetInfo
+{
+    int width;
+    int height;
+    TargetFormat format;
+    RenderTarget *target;
+    bool needed;
+    int last_reader;
+} GraphTargetInfo;
+
+struct PassGraph
+{
+    RenderPass passes[MAX_GRAPH_PASSES];
+    int passes_count;
+
+    GraphTargetInfo targets[MAX_GRAPH_TARGETS];
+    int targets_count;
+
+    // Stands in for the default framebuffer
+    RenderTarget screen;
+
+    // For the last execute_pass_graph
+    int passes_run;
+    int passes_culled;
+};
+
+void begin_pass_graph(PassGraph *graph, int screen_width, int screen_height)
+{
+    graph->passes_count = 0;
+    graph->targets_count = 1;
+
+    graph->screen.fbo = 0;
+    graph->screen.texture = 0;
+    graph->screen.width = screen_width;
+    graph->screen.height = screen_height;
+
+    GraphTargetInfo *screen = &graph->targets[GRAPH_SCREEN];
+    memset(screen, 0, sizeof(*screen));
+    screen->width = screen_width;
+    screen->height = screen_height;
+    screen->target = &graph->screen;
+}
+
+GraphTarget add_graph_target(PassGraph *graph, int width, int height,
+                             TargetFormat format)
+{
+    assert(graph->targets_count < MAX_GRAPH_TARGETS);
+
+    GraphTargetInfo *info = &graph->targets[graph->targets_count];
+    memset(info, 0, sizeof(*info));
+    info->width = width;
+    info->height = height;
+    info->format = format;
+
+    return graph->targets_count++;
+}
+
+RenderPass *add_render_pass(PassGraph *graph, const char *name,
+                            GraphTarget output, PassFunction function,
+                            void *user_data)
+{
+    assert(graph->passes_count < MAX_GRAPH_PASSES);
+    assert(output >= 0 && output < graph->targets_count);
+
+    RenderPass *pass = &graph->passes[graph->passes_count++];
+    memset(pass, 0, sizeof(*pass));
+    pass->name = name;
+    pass->function = function;
+    pass->user_data = user_data;
+    pass->output = output;
+
+    return pass;
+}
+
+// filter is how the pass samples the target, e.g. GL_NEAREST or GL_LINEAR
+void add_pass_input(PassGraph *graph, RenderPass *pass, GraphTarget target,
+                    GLint filter)
+{
+    assert(pass->inputs_count < MAX_PASS_INPUTS);
+    assert(target > GRAPH_SCREEN && target < graph->targets_count);
+
+    pass->inputs[pass->inputs_count++] = (PassInput){target, filter};
+}
+
+// The framebuffer behind the pass's i-th input, for its size
+RenderTarget *get_pass_input(PassGraph *graph, RenderPass *pass, int i)
+{
+    assert(i < pass->inputs_count);
+
+    return graph->targets[pass->inputs[i].target].target;
+}
+
+// Works back from the screen, keeping passes that draw something a kept
+// pass reads
+void cull_passes(PassGraph *graph)
+{
+    graph->targets[GRAPH_SCREEN].needed = true;
+
+    for (int i = graph->passes_count - 1; i >= 0; --i) {
+        RenderPass *pass = &graph->passes[i];
+
+        pass->culled = !graph->targets[pass->output].needed;
+        if (pass->culled) continue;
+
+        for (int j = 0; j < pass->inputs_count; ++j) {
+            GraphTargetInfo *input = &graph->targets[pass->inputs[j].target];
+
+            if (!input->needed) {
+                input->needed = true;
+                input->last_reader = i;
+            }
+        }
+    }
+}
+
+void execute_pass_graph(PassGraph *graph, RenderTargetPool *pool)
+{
+    cull_passes(graph);
+
+    graph->passes_run = 0;
+    graph->passes_culled = 0;
+
+    for (int i = 0; i < graph->passes_count; ++i) {
+        RenderPass *pass = &graph->passes[i];
+
+        if (pass->culled) {
+            ++graph->passes_culled;
+            continue;
+        }
+
+        GraphTargetInfo *output = &graph->targets[pass->output];
+
+        if (!output->target) {
+            output->target = acquire_render_target(pool, output->width,
+                                                   output->height,
+                                                   output->format);
+        }
+
+        if (output->target) {
+            bind_framebuffer(output->target->fbo);
+            glViewport(0, 0, output->width, output->height);
+
+            for (int j = 0; j < pass->inputs_count; ++j) {
+                PassInput *input = &pass->inputs[j];
+                RenderTarget *target = graph->targets[input->target].target;
+
+                bind_texture(j, target ? target->texture : 0);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                                input->filter);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+                                input->filter);
+            }
+
+            set_active_texture(0);
+
+            pass->function(graph, pass, pass->user_data);
+
+            ++graph->passes_run;
+        } else {
+            fprintf(stderr, "execute_pass_graph: no target for '%s'\n",
+                    pass->name);
+        }
+
+        // Done with anything this was the last to read
+        for (int j = 0; j < pass->inputs_count; ++j) {
+            GraphTargetInfo *input = &graph->targets[pass->inputs[j].target];
+
+            if (input->last_reader == i && input->target) {
+                release_render_target(input->target);
+                input->target = NULL;
+            }
+        }
+    }
+
+    // Anything still held, so the pool starts the next frame with
+    // everything free
+    for (int i = GRAPH_SCREEN + 1; i < graph->targets_count; ++i) {
+        GraphTargetInfo *info = &graph->targets[i];
+
+        if (info->target) {
+            release_render_target(info->target);
+            info->target = NULL;
+        }
+    }
+
+    bind_framebuffer(0);
+}
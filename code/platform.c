@@ -0,0 +1,78 @@
+// The few things the demos need from the browser: a frame loop, a clock and
+// the audio output rate. Built with emcc these call straight into emscripten.
+// Native builds run the frame loop flat out for a fixed number of frames (the
+// FRAMES environment variable, DEFAULT_NATIVE_FRAMES otherwise) and print how
+// long it took, so the hot loops can be measured with perf, callgrind and the
+// sanitizers.
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten.h>
+#include <emscripten/html5.h>
+#else
+#include <time.h>
+
+typedef int EM_BOOL;
+#define EM_TRUE 1
+#define EM_FALSE 0
+#endif
+
+#define DEFAULT_NATIVE_FRAMES 1000
+#define DEFAULT_AUDIO_FREQUENCY 44100
+
+// Returns false to stop the loop
+typedef EM_BOOL (*FrameFunction)(double time, void *user_data);
+
+// Milliseconds since some fixed point
+double get_time()
+{
+#ifdef __EMSCRIPTEN__
+    return emscripten_performance_now();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+#endif
+}
+
+void run_frame_loop(FrameFunction function, void *user_data)
+{
+#ifdef __EMSCRIPTEN__
+    emscripten_request_animation_frame_loop(function, user_data);
+#else
+    const char *frames_string = getenv("FRAMES");
+    int frames = frames_string ? atoi(frames_string) : DEFAULT_NATIVE_FRAMES;
+
+    double start_time = get_time();
+
+    int frame = 0;
+    while (frame < frames) {
+        ++frame;
+        if (!function(get_time(), user_data)) break;
+    }
+
+    double elapsed = get_time() - start_time;
+
+    printf("run_frame_loop: %d frames in %.1f ms, %.3f ms per frame\n", frame,
+           elapsed, frame ? elapsed / frame : 0.0);
+#endif
+}
+
+// The rate the browser's audio context runs at, so the mixer doesn't have to
+// resample
+int get_audio_frequency()
+{
+#ifdef __EMSCRIPTEN__
+    return EM_ASM_INT_V({
+        var context;
+        try {
+            context = new AudioContext();
+        } catch (e) {
+            context = new webkitAudioContext(); // safari only
+        }
+        return context.sampleRate;
+    });
+#else
+    return DEFAULT_AUDIO_FREQUENCY;
+#endif
+}
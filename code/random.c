@@ -0,0 +1,162 @@
+// Fast random numbers for bulk spawning, to replace rand() and its hidden
+// global state.
+//
+// A Random runs RANDOM_LANES independent xoshiro128+ generators side by side,
+// with the state stored word-major so one vector instruction steps every lane
+// at once (wasm SIMD128 or SSE2, with a scalar fallback). Each Random is
+// plain data: give every thread or job its own and seed it from something
+// deterministic, such as a frame and chunk number, for reproducible runs.
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define RANDOM_LANES 4
+
+typedef struct Random
+{
+    uint32_t state[4][RANDOM_LANES];
+} Random;
+
+uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+void seed_random(Random *random, uint64_t seed)
+{
+    for (int lane = 0; lane < RANDOM_LANES; ++lane) {
+        for (int word = 0; word < 4; word += 2) {
+            uint64_t bits = splitmix64(&seed);
+
+            random->state[word][lane] = (uint32_t)bits;
+            random->state[word + 1][lane] = (uint32_t)(bits >> 32);
+        }
+    }
+}
+
+// Produces the next RANDOM_LANES 32 bit values
+void next_random_block(Random *random, uint32_t *out)
+{
+#if defined(__wasm_simd128__)
+    v128_t s0 = wasm_v128_load(random->state[0]);
+    v128_t s1 = wasm_v128_load(random->state[1]);
+    v128_t s2 = wasm_v128_load(random->state[2]);
+    v128_t s3 = wasm_v128_load(random->state[3]);
+
+    wasm_v128_store(out, wasm_i32x4_add(s0, s3));
+
+    v128_t t = wasm_i32x4_shl(s1, 9);
+
+    s2 = wasm_v128_xor(s2, s0);
+    s3 = wasm_v128_xor(s3, s1);
+    s1 = wasm_v128_xor(s1, s2);
+    s0 = wasm_v128_xor(s0, s3);
+    s2 = wasm_v128_xor(s2, t);
+    s3 = wasm_v128_or(wasm_i32x4_shl(s3, 11), wasm_u32x4_shr(s3, 21));
+
+    wasm_v128_store(random->state[0], s0);
+    wasm_v128_store(random->state[1], s1);
+    wasm_v128_store(random->state[2], s2);
+    wasm_v128_store(random->state[3], s3);
+#elif defined(__SSE2__)
+    __m128i s0 = _mm_loadu_si128((__m128i *)random->state[0]);
+    __m128i s1 = _mm_loadu_si128((__m128i *)random->state[1]);
+    __m128i s2 = _mm_loadu_si128((__m128i *)random->state[2]);
+    __m128i s3 = _mm_loadu_si128((__m128i *)random->state[3]);
+
+    _mm_storeu_si128((__m128i *)out, _mm_add_epi32(s0, s3));
+
+    __m128i t = _mm_slli_epi32(s1, 9);
+
+    s2 = _mm_xor_si128(s2, s0);
+    s3 = _mm_xor_si128(s3, s1);
+    s1 = _mm_xor_si128(s1, s2);
+    s0 = _mm_xor_si128(s0, s3);
+    s2 = _mm_xor_si128(s2, t);
+    s3 = _mm_or_si128(_mm_slli_epi32(s3, 11), _mm_srli_epi32(s3, 21));
+
+    _mm_storeu_si128((__m128i *)random->state[0], s0);
+    _mm_storeu_si128((__m128i *)random->state[1], s1);
+    _mm_storeu_si128((__m128i *)random->state[2], s2);
+    _mm_storeu_si128((__m128i *)random->state[3], s3);
+#else
+    for (int lane = 0; lane < RANDOM_LANES; ++lane) {
+        uint32_t s0 = random->state[0][lane];
+        uint32_t s1 = random->state[1][lane];
+        uint32_t s2 = random->state[2][lane];
+        uint32_t s3 = random->state[3][lane];
+
+        out[lane] = s0 + s3;
+
+        uint32_t t = s1 << 9;
+
+        s2 ^= s0;
+        s3 ^= s1;
+        s1 ^= s2;
+        s0 ^= s3;
+        s2 ^= t;
+        s3 = (s3 << 11) | (s3 >> 21);
+
+        random->state[0][lane] = s0;
+        random->state[1][lane] = s1;
+        random->state[2][lane] = s2;
+        random->state[3][lane] = s3;
+    }
+#endif
+}
+
+void fill_uniform_u32(Random *random, uint32_t *out, int n)
+{
+    int i = 0;
+    for (; i + RANDOM_LANES <= n; i += RANDOM_LANES) {
+        next_random_block(random, out + i);
+    }
+
+    if (i < n) {
+        uint32_t block[RANDOM_LANES];
+        next_random_block(random, block);
+
+        memcpy(out + i, block, (n - i) * sizeof(*out));
+    }
+}
+
+// Fills out with floats in [0, 1). The top 23 bits of each value become the
+// mantissa of a float in [1, 2), so there's no divide or int conversion.
+void fill_uniform_floats(Random *random, float *out, int n)
+{
+    uint32_t *bits = (uint32_t *)out;
+
+    fill_uniform_u32(random, bits, n);
+
+    int i = 0;
+
+#if defined(__wasm_simd128__)
+    for (; i + 4 <= n; i += 4) {
+        v128_t v = wasm_v128_load(bits + i);
+        v = wasm_v128_or(wasm_u32x4_shr(v, 9), wasm_i32x4_splat(0x3F800000));
+        wasm_v128_store(out + i, wasm_f32x4_sub(v, wasm_f32x4_splat(1.0f)));
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((__m128i *)(bits + i));
+        v = _mm_or_si128(_mm_srli_epi32(v, 9), _mm_set1_epi32(0x3F800000));
+        _mm_storeu_ps(out + i,
+                      _mm_sub_ps(_mm_castsi128_ps(v), _mm_set1_ps(1.0f)));
+    }
+#endif
+
+    for (; i < n; ++i) {
+        uint32_t v = (bits[i] >> 9) | 0x3F800000;
+
+        float f;
+        memcpy(&f, &v, sizeof(f));
+
+        out[i] = f - 1.0f;
+    }
+}
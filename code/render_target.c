@@ -0,0 +1,170 @@
+// Hands out framebuffers with a colour texture attached, keyed by size and
+// format, and takes them back to hand out again. Anything that only needs
+// somewhere to draw for part of a frame acquires a target and releases it as
+// soon as the last reader is done with it, so a few targets serve any number
+// of passes.
+//
+// Targets nobody has acquired for RENDER_TARGET_IDLE_FRAMES frames are
+// deleted, so what the pool holds stays bounded by what recent frames
+// needed rather than by everything ever asked for.
+
+#define MAX_RENDER_TARGETS 16
+#define RENDER_TARGET_IDLE_FRAMES 60
+
+// Colour formats GLES2 can render to without extensions
+typedef enum TargetFormat
+{
+    TARGET_RGBA8,
+    TARGET_RGB565,
+    TARGET_FORMATS_COUNT,
+} TargetFormat;
+
+typedef struct RenderTarget
+{
+    GLuint fbo;
+    GLuint texture;
+    int width;
+    int height;
+    TargetFormat format;
+    bool in_use;
+    unsigned last_used;
+} RenderTarget;
+
+typedef struct RenderTargetPool
+{
+    RenderTarget targets[MAX_RENDER_TARGETS];
+    int targets_count;
+    unsigned frame;
+
+    // Running totals, for measuring
+    int targets_created;
+    size_t bytes;
+} RenderTargetPool;
+
+int target_format_bytes(TargetFormat format)
+{
+    return format == TARGET_RGB565 ? 2 : 4;
+}
+
+bool create_render_target(RenderTarget *target, int width, int height,
+                          TargetFormat format)
+{
+    GLenum pixel_format = format == TARGET_RGB565 ? GL_RGB : GL_RGBA;
+    GLenum type =
+        format == TARGET_RGB565 ? GL_UNSIGNED_SHORT_5_6_5 : GL_UNSIGNED_BYTE;
+
+    target->width = width;
+    target->height = height;
+    target->format = format;
+    target->in_use = false;
+    target->last_used = 0;
+
+    glGenTextures(1, &target->texture);
+    bind_texture(0, target->texture);
+
+    glTexImage2D(GL_TEXTURE_2D, 0, pixel_format, width, height, 0,
+                 pixel_format, type, NULL);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenFramebuffers(1, &target->fbo);
+    bind_framebuffer(target->fbo);
+
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, target->texture, 0);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+    bind_framebuffer(0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "create_render_target: incomplete FBO: %d\n", status);
+
+        delete_framebuffer(target->fbo);
+        delete_texture(target->texture);
+        return false;
+    }
+
+    return true;
+}
+
+void delete_render_target(RenderTarget *target)
+{
+    delete_framebuffer(target->fbo);
+    delete_texture(target->texture);
+}
+
+void create_render_target_pool(RenderTargetPool *pool)
+{
+    memset(pool, 0, sizeof(*pool));
+}
+
+// Returns a free target of the given size and format, making one if none
+// is free. Returns NULL if the pool is full.
+RenderTarget *acquire_render_target(RenderTargetPool *pool, int width,
+                                    int height, TargetFormat format)
+{
+    for (int i = 0; i < pool->targets_count; ++i) {
+        RenderTarget *target = &pool->targets[i];
+
+        if (!target->in_use && target->width == width &&
+            target->height == height && target->format == format) {
+            target->in_use = true;
+            target->last_used = pool->frame;
+            return target;
+        }
+    }
+
+    if (pool->targets_count == MAX_RENDER_TARGETS) {
+        fprintf(stderr, "acquire_render_target: no more than %d targets\n",
+                MAX_RENDER_TARGETS);
+        return NULL;
+    }
+
+    RenderTarget *target = &pool->targets[pool->targets_count];
+
+    if (!create_render_target(target, width, height, format)) return NULL;
+
+    ++pool->targets_count;
+    ++pool->targets_created;
+    pool->bytes += width * height * target_format_bytes(format);
+
+    target->in_use = true;
+    target->last_used = pool->frame;
+
+    return target;
+}
+
+// Hands the target back. Its contents are undefined from here on.
+void release_render_target(RenderTarget *target)
+{
+    assert(target->in_use);
+    target->in_use = false;
+}
+
+// Call once a frame, while nothing is acquired. Deletes the targets that
+// have been idle too long.
+void begin_render_target_frame(RenderTargetPool *pool)
+{
+    ++pool->frame;
+
+    for (int i = 0; i < pool->targets_count;) {
+        RenderTarget *target = &pool->targets[i];
+
+        assert(!target->in_use);
+
+        if (pool->frame - target->last_used > RENDER_TARGET_IDLE_FRAMES) {
+            pool->bytes -= target->width * target->height *
+                           target_format_bytes(target->format);
+
+            delete_render_target(target);
+
+            *target = pool->targets[--pool->targets_count];
+        } else {
+            ++i;
+        }
+    }
+}
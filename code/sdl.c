@@ -2,6 +2,13 @@
 #include <SDL2/SDL_mixer.h>
 #include <GLES2/gl2.h>
 
+// HEADLESS builds skip the window and render into an offscreen EGL surface,
+// e.g. with Mesa's surfaceless platform and software rasterizer
+#ifdef HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
 typedef struct SDL
 {
     SDL_Window *window;
@@ -9,6 +16,11 @@ typedef struct SDL
     const Uint8 *keyboard_state;
     int keyboard_state_size;
     bool mixer_initialised;
+#ifdef HEADLESS
+    EGLDisplay display;
+    EGLSurface surface;
+    EGLContext context;
+#endif
 } SDL;
 
 bool setup_sdl_mixer(SDL *sdl, int frequency)
@@ -35,13 +47,120 @@ void cleanup_sdl_mixer()
     Mix_CloseAudio();
 }
 
+#ifdef HEADLESS
+bool setup_headless_gl(SDL *sdl, int width, int height)
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+            "eglGetPlatformDisplayEXT");
+
+    sdl->display = EGL_NO_DISPLAY;
+
+    if (get_platform_display) {
+        sdl->display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                            EGL_DEFAULT_DISPLAY, NULL);
+    }
+
+    if (sdl->display == EGL_NO_DISPLAY) {
+        sdl->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+
+    if (!eglInitialize(sdl->display, NULL, NULL)) {
+        fprintf(stderr, "setup_headless_gl: eglInitialize: 0x%x\n",
+                eglGetError());
+        return false;
+    }
+
+#ifdef USE_WEBGL2
+    EGLint renderable_type = EGL_OPENGL_ES3_BIT_KHR;
+    EGLint client_version = 3;
+#else
+    EGLint renderable_type = EGL_OPENGL_ES2_BIT;
+    EGLint client_version = 2;
+#endif
+
+    EGLint config_attributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, renderable_type,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_NONE,
+    };
+
+    EGLConfig config;
+    EGLint configs_count;
+    if (!eglChooseConfig(sdl->display, config_attributes, &config, 1,
+                         &configs_count) ||
+        configs_count == 0) {
+        fprintf(stderr, "setup_headless_gl: no suitable EGL config\n");
+        return false;
+    }
+
+    EGLint surface_attributes[] = {
+        EGL_WIDTH, width,
+        EGL_HEIGHT, height,
+        EGL_NONE,
+    };
+
+    sdl->surface =
+        eglCreatePbufferSurface(sdl->display, config, surface_attributes);
+    if (sdl->surface == EGL_NO_SURFACE) {
+        fprintf(stderr, "setup_headless_gl: eglCreatePbufferSurface: 0x%x\n",
+                eglGetError());
+        return false;
+    }
+
+    eglBindAPI(EGL_OPENGL_ES_API);
+
+    EGLint context_attributes[] = {
+        EGL_CONTEXT_CLIENT_VERSION, client_version,
+        EGL_NONE,
+    };
+
+    sdl->context = eglCreateContext(sdl->display, config, EGL_NO_CONTEXT,
+                                    context_attributes);
+    if (sdl->context == EGL_NO_CONTEXT) {
+        fprintf(stderr, "setup_headless_gl: eglCreateContext: 0x%x\n",
+                eglGetError());
+        return false;
+    }
+
+    if (!eglMakeCurrent(sdl->display, sdl->surface, sdl->surface,
+                        sdl->context)) {
+        fprintf(stderr, "setup_headless_gl: eglMakeCurrent: 0x%x\n",
+                eglGetError());
+        return false;
+    }
+
+    return true;
+}
+#endif
+
 bool setup_sdl(SDL *sdl, int window_width, int window_height)
 {
+#ifdef HEADLESS
+    // Nothing needs a subsystem without a window, and CI hosts often have
+    // no audio device. Mix_OpenAudio starts audio itself if a demo wants it.
+    if (SDL_Init(0) < 0) {
+        fprintf(stderr, "setup_sdl: SDL_Init: %s\n", SDL_GetError());
+        return false;
+    }
+
+    if (!setup_headless_gl(sdl, window_width, window_height)) return false;
+#else
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
         fprintf(stderr, "setup_sdl: SDL_Init: %s\n", SDL_GetError());
         return false;
     }
 
+#ifdef USE_WEBGL2
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_ES);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 0);
+#endif
+
     sdl->window = SDL_CreateWindow("EMCC Test", SDL_WINDOWPOS_CENTERED,
                                    SDL_WINDOWPOS_CENTERED, window_width,
                                    window_height, SDL_WINDOW_OPENGL);
@@ -57,6 +176,7 @@ bool setup_sdl(SDL *sdl, int window_width, int window_height)
                 SDL_GetError());
         return false;
     }
+#endif
 
     sdl->keyboard_state = SDL_GetKeyboardState(&sdl->keyboard_state_size);
 
@@ -71,7 +191,24 @@ void cleanup_sdl(const SDL *sdl)
         cleanup_sdl_mixer();
     }
 
+#ifdef HEADLESS
+    if (sdl->display != EGL_NO_DISPLAY) {
+        eglMakeCurrent(sdl->display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                       EGL_NO_CONTEXT);
+        eglTerminate(sdl->display);
+    }
+#else
     SDL_GL_DeleteContext(sdl->glcontext);
     SDL_DestroyWindow(sdl->window);
+#endif
     SDL_Quit();
 }
+
+void swap_sdl_window(const SDL *sdl)
+{
+#ifdef HEADLESS
+    eglSwapBuffers(sdl->display, sdl->surface);
+#else
+    SDL_GL_SwapWindow(sdl->window);
+#endif
+}
@@ -0,0 +1,505 @@
+// Builds a set of shader programs together. Compiling and linking one at a
+// time and asking for its status straight away makes the driver finish each
+// before the next is started, so startup grows with every program added.
+// Here every compile and link is submitted first and only then checked, so
+// the driver can work on them all at once, on other threads with
+// KHR_parallel_shader_compile, where shader_programs_ready can be polled to
+// keep drawing frames meanwhile.
+//
+// Native builds with OES_get_program_binary, or GLES3, also keep each linked
+// program's binary in cache_directory, named by a hash of its sources and
+// the driver. Later runs load those instead of compiling. Whether the driver
+// took a binary is only asked in finish_shader_programs, which compiles the
+// program as usual if it didn't.
+
+#define MAX_SHADER_PROGRAMS 32
+#define MAX_SHADER_ATTRIBUTES 8
+#define SHADER_BINARY_MAGIC 0x52444853u // "SHDR"
+#define SHADER_BINARY_VERSION 1
+
+// GLES3's, which OES_get_program_binary doesn't have
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+
+typedef void(GL_APIENTRYP ProgramParameteriFunction)(GLuint program,
+                                                     GLenum name, GLint value);
+
+typedef struct ShaderEntry
+{
+    Program *program;
+    const char *vertex_code;
+    const char *fragment_code;
+    const char *attributes[MAX_SHADER_ATTRIBUTES];
+    int attributes_count;
+
+    uint64_t hash;
+    GLuint object;
+    GLuint vertex_shader;
+    GLuint fragment_shader;
+    bool from_binary;
+} ShaderEntry;
+
+typedef struct ShaderBinaryHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+    uint32_t format;
+    uint32_t length;
+} ShaderBinaryHeader;
+
+typedef struct ShaderManager
+{
+    ShaderEntry entries[MAX_SHADER_PROGRAMS];
+    int entries_count;
+
+    bool parallel_compile;
+    const char *cache_directory;
+    uint64_t driver_hash;
+    PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+    PFNGLPROGRAMBINARYOESPROC program_binary;
+    ProgramParameteriFunction program_parameter;
+
+    // For the last build, for measuring
+    int programs_compiled;
+    int programs_loaded;
+    double build_ms;
+} ShaderManager;
+
+uint64_t hash_shader_string(uint64_t hash, const char *s)
+{
+    // Include the terminator, so moving text between strings changes it
+    do {
+        hash = (hash ^ (uint8_t)*s) * 0x100000001B3ull;
+    } while (*s++);
+
+    return hash;
+}
+
+#ifndef __EMSCRIPTEN__
+// WebGL has no program binaries, so this is for native builds only
+void load_program_binaries(ShaderManager *manager)
+{
+    const char *suffix = NULL;
+
+    if (has_gl_extension("OES_get_program_binary")) {
+        suffix = "OES";
+    } else if (strstr((const char *)glGetString(GL_VERSION),
+                      "OpenGL ES 3") != NULL) {
+        suffix = "";
+    } else {
+        return;
+    }
+
+    GLint formats_count = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats_count);
+    if (formats_count == 0) return;
+
+    char name[64];
+
+    snprintf(name, sizeof(name), "glGetProgramBinary%s", suffix);
+    manager->get_program_binary =
+        (PFNGLGETPROGRAMBINARYOESPROC)get_gl_proc_address(name);
+
+    snprintf(name, sizeof(name), "glProgramBinary%s", suffix);
+    manager->program_binary =
+        (PFNGLPROGRAMBINARYOESPROC)get_gl_proc_address(name);
+
+    if (!manager->get_program_binary || !manager->program_binary) {
+        manager->get_program_binary = NULL;
+        manager->program_binary = NULL;
+        return;
+    }
+
+    // GLES3 drivers may only keep a binary to hand back when asked to
+    // before linking
+    if (strstr((const char *)glGetString(GL_VERSION), "OpenGL ES 3") != NULL) {
+        manager->program_parameter =
+            (ProgramParameteriFunction)get_gl_proc_address(
+                "glProgramParameteri");
+    }
+}
+#endif
+
+// cache_directory is where program binaries are kept between runs, or NULL
+// for none. It has to exist already.
+void create_shader_manager(ShaderManager *manager, const char *cache_directory)
+{
+    memset(manager, 0, sizeof(*manager));
+
+    if (has_gl_extension("KHR_parallel_shader_compile")) {
+        manager->parallel_compile = true;
+
+        // As many threads as the driver likes. WebGL has no such call.
+        PFNGLMAXSHADERCOMPILERTHREADSKHRPROC max_compiler_threads =
+            (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)get_gl_proc_address(
+                "glMaxShaderCompilerThreadsKHR");
+
+        if (max_compiler_threads) max_compiler_threads(0xFFFFFFFFu);
+    }
+
+#ifndef __EMSCRIPTEN__
+    if (cache_directory) {
+        manager->cache_directory = cache_directory;
+        load_program_binaries(manager);
+    }
+#endif
+
+    // A binary is only any good to the driver that made it
+    manager->driver_hash = 0xCBF29CE484222325ull;
+    manager->driver_hash = hash_shader_string(
+        manager->driver_hash, (const char *)glGetString(GL_RENDERER));
+    manager->driver_hash = hash_shader_string(
+        manager->driver_hash, (const char *)glGetString(GL_VERSION));
+}
+
+// Queues a program to build into program. The attributes are bound to
+// locations 0 up in the order they're named. Nothing is copied, so the
+// sources have to last until the build is finished.
+bool add_shader_program(ShaderManager *manager, Program *program,
+                        const char *vertex_code, const char *fragment_code,
+                        const char *const attributes[], int attributes_count)
+{
+    assert(attributes_count <= MAX_SHADER_ATTRIBUTES);
+
+    if (manager->entries_count == MAX_SHADER_PROGRAMS) {
+        fprintf(stderr, "add_shader_program: no more than %d programs\n",
+                MAX_SHADER_PROGRAMS);
+        return false;
+    }
+
+    ShaderEntry *entry = &manager->entries[manager->entries_count++];
+    memset(entry, 0, sizeof(*entry));
+
+    entry->program = program;
+    entry->vertex_code = vertex_code;
+    entry->fragment_code = fragment_code;
+    entry->attributes_count = attributes_count;
+
+    for (int i = 0; i < attributes_count; ++i) {
+        entry->attributes[i] = attributes[i];
+    }
+
+    return true;
+}
+
+void get_shader_binary_filename(ShaderManager *manager, ShaderEntry *entry,
+                                char *filename, size_t size)
+{
+    snprintf(filename, size, "%s/%016llx.bin", manager->cache_directory,
+             (unsigned long long)entry->hash);
+}
+
+// Gives the entry a program made from the binary a previous run saved, if
+// there is one. Whether the driver takes it is left for
+// finish_shader_programs to ask, as asking here would wait for it.
+bool load_shader_binary(ShaderManager *manager, ShaderEntry *entry)
+{
+    if (!manager->program_binary) return false;
+
+    char filename[256];
+    get_shader_binary_filename(manager, entry, filename, sizeof(filename));
+
+    FILE *file = fopen(filename, "rb");
+    if (!file) return false;
+
+    ShaderBinaryHeader header;
+    void *binary = NULL;
+
+    bool read = fread(&header, sizeof(header), 1, file) == 1 &&
+                header.magic == SHADER_BINARY_MAGIC &&
+                header.version == SHADER_BINARY_VERSION &&
+                header.hash == entry->hash &&
+                (binary = malloc(header.length)) != NULL &&
+                fread(binary, 1, header.length, file) == header.length;
+
+    fclose(file);
+
+    if (read) {
+        entry->object = glCreateProgram();
+        read = entry->object != 0;
+    }
+
+    if (read) {
+        manager->program_binary(entry->object, header.format, binary,
+                                header.length);
+    }
+
+    free(binary);
+
+    return read;
+}
+
+// Keeps the entry's newly linked program for later runs. Failing to is only
+// reported, as the program is fine without it.
+void save_shader_binary(ShaderManager *manager, ShaderEntry *entry)
+{
+    if (!manager->get_program_binary) return;
+
+    GLint length = 0;
+    glGetProgramiv(entry->object, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0) return;
+
+    void *binary = malloc(length);
+    if (!binary) return;
+
+    GLenum format;
+    manager->get_program_binary(entry->object, length, &length, &format,
+                                binary);
+
+    ShaderBinaryHeader header = {0};
+    header.magic = SHADER_BINARY_MAGIC;
+    header.version = SHADER_BINARY_VERSION;
+    header.hash = entry->hash;
+    header.format = format;
+    header.length = length;
+
+    char filename[256];
+    get_shader_binary_filename(manager, entry, filename, sizeof(filename));
+
+    FILE *file = fopen(filename, "wb");
+    if (file) {
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(binary, 1, length, file);
+
+        if (ferror(file)) {
+            fprintf(stderr, "save_shader_binary: error writing '%s'\n",
+                    filename);
+        }
+
+        fclose(file);
+    } else {
+        fprintf(stderr, "save_shader_binary: can't open '%s'\n", filename);
+    }
+
+    free(binary);
+}
+
+// Compiles without waiting to find out how it went
+GLuint submit_shader(const char *code, GLenum type)
+{
+    GLuint shader = glCreateShader(type);
+    if (!shader) return 0;
+
+    glShaderSource(shader, 1, &code, NULL);
+    glCompileShader(shader);
+
+    return shader;
+}
+
+// Creates the entry's program and starts it compiling and linking
+bool submit_shader_entry(ShaderManager *manager, ShaderEntry *entry)
+{
+    entry->object = glCreateProgram();
+    if (!entry->object) {
+        fprintf(stderr, "submit_shader_entry: glCreateProgram failed\n");
+        return false;
+    }
+
+    entry->vertex_shader = submit_shader(entry->vertex_code, GL_VERTEX_SHADER);
+    entry->fragment_shader =
+        submit_shader(entry->fragment_code, GL_FRAGMENT_SHADER);
+
+    glAttachShader(entry->object, entry->vertex_shader);
+    glAttachShader(entry->object, entry->fragment_shader);
+
+    for (int i = 0; i < entry->attributes_count; ++i) {
+        glBindAttribLocation(entry->object, i, entry->attributes[i]);
+    }
+
+    if (manager->program_parameter) {
+        manager->program_parameter(entry->object,
+                                   GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    glLinkProgram(entry->object);
+
+    return true;
+}
+
+// Throws away the first count entries' programs and shaders, and the queue
+void delete_shader_entries(ShaderManager *manager, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        ShaderEntry *entry = &manager->entries[i];
+
+        if (!entry->from_binary) {
+            glDeleteShader(entry->vertex_shader);
+            glDeleteShader(entry->fragment_shader);
+        }
+
+        glDeleteProgram(entry->object);
+        entry->object = 0;
+    }
+
+    manager->entries_count = 0;
+}
+
+// Starts every queued program building, from a binary where there's a good
+// one. Nothing here waits for a compile or link to finish.
+bool submit_shader_programs(ShaderManager *manager)
+{
+    double start = get_time();
+
+    manager->programs_compiled = 0;
+    manager->programs_loaded = 0;
+
+    for (int i = 0; i < manager->entries_count; ++i) {
+        ShaderEntry *entry = &manager->entries[i];
+
+        entry->hash = hash_shader_string(manager->driver_hash,
+                                         entry->vertex_code);
+        entry->hash = hash_shader_string(entry->hash, entry->fragment_code);
+
+        for (int j = 0; j < entry->attributes_count; ++j) {
+            entry->hash = hash_shader_string(entry->hash,
+                                             entry->attributes[j]);
+        }
+
+        entry->from_binary = load_shader_binary(manager, entry);
+
+        if (entry->from_binary) {
+            ++manager->programs_loaded;
+            continue;
+        }
+
+        if (!submit_shader_entry(manager, entry)) {
+            delete_shader_entries(manager, i);
+            return false;
+        }
+
+        ++manager->programs_compiled;
+    }
+
+    manager->build_ms = get_time() - start;
+
+    return true;
+}
+
+// Whether every submitted program has finished building, so that
+// finish_shader_programs won't wait. Without KHR_parallel_shader_compile
+// there's no asking, so it's always true.
+bool shader_programs_ready(ShaderManager *manager)
+{
+    if (!manager->parallel_compile) return true;
+
+    for (int i = 0; i < manager->entries_count; ++i) {
+        ShaderEntry *entry = &manager->entries[i];
+
+        GLint completed;
+        glGetProgramiv(entry->object, GL_COMPLETION_STATUS_KHR, &completed);
+
+        if (!completed) return false;
+    }
+
+    return true;
+}
+
+void print_shader_log(const char *stage, GLuint shader)
+{
+    GLint compiled;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (compiled) return;
+
+    GLint info_length = 0;
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &info_length);
+
+    char *info_log = malloc(info_length > 1 ? info_length : 1);
+    if (!info_log) return;
+
+    info_log[0] = '\0';
+    glGetShaderInfoLog(shader, info_length, NULL, info_log);
+
+    fprintf(stderr, "finish_shader_programs: error compiling %s shader: %s\n",
+            stage, info_log);
+
+    free(info_log);
+}
+
+void print_program_log(GLuint program)
+{
+    GLint info_length = 0;
+    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &info_length);
+
+    char *info_log = malloc(info_length > 1 ? info_length : 1);
+    if (!info_log) return;
+
+    info_log[0] = '\0';
+    glGetProgramInfoLog(program, info_length, NULL, info_log);
+
+    fprintf(stderr, "finish_shader_programs: error linking: %s\n", info_log);
+
+    free(info_log);
+}
+
+// Checks how every program built, waiting for any that haven't finished,
+// and fills in their Programs. Returns false if any failed, after reporting
+// why.
+bool finish_shader_programs(ShaderManager *manager)
+{
+    double start = get_time();
+    bool built = true;
+
+    for (int i = 0; i < manager->entries_count; ++i) {
+        ShaderEntry *entry = &manager->entries[i];
+
+        if (entry->from_binary) {
+            GLint linked;
+            glGetProgramiv(entry->object, GL_LINK_STATUS, &linked);
+
+            // Turned down, so compile it after all, in a program that hasn't
+            // seen the binary
+            if (!linked) {
+                glDeleteProgram(entry->object);
+                entry->object = 0;
+                entry->from_binary = false;
+
+                --manager->programs_loaded;
+                ++manager->programs_compiled;
+
+                if (!submit_shader_entry(manager, entry)) {
+                    built = false;
+                    continue;
+                }
+            }
+        }
+
+        if (!entry->from_binary) {
+            GLint linked;
+            glGetProgramiv(entry->object, GL_LINK_STATUS, &linked);
+
+            if (linked) {
+                save_shader_binary(manager, entry);
+            } else {
+                print_shader_log("vertex", entry->vertex_shader);
+                print_shader_log("fragment", entry->fragment_shader);
+                print_program_log(entry->object);
+            }
+
+            // The program keeps what it needs of them
+            glDeleteShader(entry->vertex_shader);
+            glDeleteShader(entry->fragment_shader);
+
+            if (!linked) {
+                glDeleteProgram(entry->object);
+                entry->object = 0;
+                built = false;
+                continue;
+            }
+        }
+
+        if (!reflect_program(entry->program, entry->object)) built = false;
+    }
+
+    manager->entries_count = 0;
+    manager->build_ms += get_time() - start;
+
+    return built;
+}
+
+// Builds everything queued, for callers with nothing else to do meanwhile
+bool build_shader_programs(ShaderManager *manager)
+{
+    return submit_shader_programs(manager) && finish_shader_programs(manager);
+}
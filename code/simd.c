@@ -0,0 +1,114 @@
+// Thin wrappers over the target's vector instructions so that hot loops can be
+// written once: wasm SIMD128 under emcc -msimd128, AVX or SSE natively, and a
+// scalar fallback everywhere else. Each operation works on SIMD_WIDTH floats.
+// Loads and stores are unaligned so plain malloc'd arrays can be used.
+
+#if defined(__wasm_simd128__)
+
+#include <wasm_simd128.h>
+
+#define SIMD_WIDTH 4
+
+typedef v128_t simd_float;
+
+static inline simd_float simd_load(const float *p) { return wasm_v128_load(p); }
+
+static inline void simd_store(float *p, simd_float v) { wasm_v128_store(p, v); }
+
+static inline simd_float simd_splat(float f) { return wasm_f32x4_splat(f); }
+
+static inline simd_float simd_add(simd_float a, simd_float b)
+{
+    return wasm_f32x4_add(a, b);
+}
+
+static inline simd_float simd_mul(simd_float a, simd_float b)
+{
+    return wasm_f32x4_mul(a, b);
+}
+
+// Returns one bit per lane, set where a > b
+static inline int simd_mask_gt(simd_float a, simd_float b)
+{
+    return wasm_i32x4_bitmask(wasm_f32x4_gt(a, b));
+}
+
+#elif defined(__AVX__)
+
+#include <immintrin.h>
+
+#define SIMD_WIDTH 8
+
+typedef __m256 simd_float;
+
+static inline simd_float simd_load(const float *p) { return _mm256_loadu_ps(p); }
+
+static inline void simd_store(float *p, simd_float v) { _mm256_storeu_ps(p, v); }
+
+static inline simd_float simd_splat(float f) { return _mm256_set1_ps(f); }
+
+static inline simd_float simd_add(simd_float a, simd_float b)
+{
+    return _mm256_add_ps(a, b);
+}
+
+static inline simd_float simd_mul(simd_float a, simd_float b)
+{
+    return _mm256_mul_ps(a, b);
+}
+
+static inline int simd_mask_gt(simd_float a, simd_float b)
+{
+    return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_GT_OQ));
+}
+
+#elif defined(__SSE__)
+
+#include <xmmintrin.h>
+
+#define SIMD_WIDTH 4
+
+typedef __m128 simd_float;
+
+static inline simd_float simd_load(const float *p) { return _mm_loadu_ps(p); }
+
+static inline void simd_store(float *p, simd_float v) { _mm_storeu_ps(p, v); }
+
+static inline simd_float simd_splat(float f) { return _mm_set1_ps(f); }
+
+static inline simd_float simd_add(simd_float a, simd_float b)
+{
+    return _mm_add_ps(a, b);
+}
+
+static inline simd_float simd_mul(simd_float a, simd_float b)
+{
+    return _mm_mul_ps(a, b);
+}
+
+static inline int simd_mask_gt(simd_float a, simd_float b)
+{
+    return _mm_movemask_ps(_mm_cmpgt_ps(a, b));
+}
+
+#else
+
+#define SIMD_WIDTH 1
+
+typedef float simd_float;
+
+static inline simd_float simd_load(const float *p) { return *p; }
+
+static inline void simd_store(float *p, simd_float v) { *p = v; }
+
+static inline simd_float simd_splat(float f) { return f; }
+
+static inline simd_float simd_add(simd_float a, simd_float b) { return a + b; }
+
+static inline simd_float simd_mul(simd_float a, simd_float b) { return a * b; }
+
+static inline int simd_mask_gt(simd_float a, simd_float b) { return a > b; }
+
+#endif
+
+#define SIMD_ALL_LANES ((1 << SIMD_WIDTH) - 1)
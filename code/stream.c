@@ -0,0 +1,155 @@
+// Streaming vertex buffer for data that is rebuilt every frame.
+//
+// Writing into a buffer the GPU may still be reading from the previous frame
+// forces the driver to wait. To avoid that, each frame either moves on to the
+// next of STREAM_BUFFER_COUNT buffers (STREAM_RING) or orphans the buffer's
+// storage with glBufferData(NULL) so the driver can hand back fresh memory
+// (STREAM_ORPHAN).
+//
+// WebGL can't map buffers, so allocations point into a CPU-side staging copy
+// and stream_flush uploads everything written since the last flush in a
+// single glBufferSubData call. Data that's already laid out as the vertices
+// need it can skip the staging copy and go up with stream_upload.
+
+#define STREAM_BUFFER_COUNT 3
+#define STREAM_ALIGNMENT 4
+
+typedef enum StreamMode
+{
+    STREAM_RING,
+    STREAM_ORPHAN,
+} StreamMode;
+
+typedef struct StreamBuffer
+{
+    GLuint buffers[STREAM_BUFFER_COUNT];
+    uint8_t *data;
+    int size;
+    int offset;
+    int flushed;
+    int current;
+    StreamMode mode;
+
+    // Running total, for measuring
+    uint64_t bytes_uploaded;
+} StreamBuffer;
+
+bool create_stream_buffer(StreamBuffer *stream, int size, StreamMode mode)
+{
+    stream->data = malloc(size);
+    if (!stream->data) {
+        fprintf(stderr, "create_stream_buffer: out of memory\n");
+        return false;
+    }
+
+    stream->size = size;
+    stream->mode = mode;
+    stream->offset = 0;
+    stream->flushed = 0;
+    stream->current = 0;
+    stream->bytes_uploaded = 0;
+
+    int count = mode == STREAM_RING ? STREAM_BUFFER_COUNT : 1;
+
+    glGenBuffers(count, stream->buffers);
+
+    for (int i = 0; i < count; ++i) {
+        bind_buffer(GL_ARRAY_BUFFER, stream->buffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+    }
+
+    return true;
+}
+
+// Starts a new frame's worth of allocations and binds the buffer they'll be
+// uploaded to.
+void stream_begin_frame(StreamBuffer *stream)
+{
+    stream->offset = 0;
+    stream->flushed = 0;
+
+    if (stream->mode == STREAM_RING) {
+        stream->current = (stream->current + 1) % STREAM_BUFFER_COUNT;
+
+        bind_buffer(GL_ARRAY_BUFFER, stream->buffers[stream->current]);
+    } else {
+        bind_buffer(GL_ARRAY_BUFFER, stream->buffers[0]);
+
+        glBufferData(GL_ARRAY_BUFFER, stream->size, NULL, GL_STREAM_DRAW);
+    }
+}
+
+// Returns the offset of bytes reserved in the current frame, or -1 if they
+// won't fit
+int stream_reserve(StreamBuffer *stream, int bytes)
+{
+    int offset = (stream->offset + STREAM_ALIGNMENT - 1) &
+                 ~(STREAM_ALIGNMENT - 1);
+
+    if (offset + bytes > stream->size) return -1;
+
+    stream->offset = offset + bytes;
+
+    return offset;
+}
+
+// Reserves bytes in the current frame. Returns where to write them and sets
+// gl_offset to their offset in the bound buffer, for glVertexAttribPointer.
+// Returns NULL if they won't fit, which callers must handle.
+void *stream_alloc(StreamBuffer *stream, int bytes, GLintptr *gl_offset)
+{
+    int offset = stream_reserve(stream, bytes);
+
+    if (offset < 0) {
+        fprintf(stderr, "stream_alloc: %d bytes won't fit in stream of %d\n",
+                bytes, stream->size);
+        return NULL;
+    }
+
+    *gl_offset = offset;
+
+    return stream->data + offset;
+}
+
+// Uploads everything allocated since the last flush.
+void stream_flush(StreamBuffer *stream)
+{
+    if (stream->offset == stream->flushed) return;
+
+    bind_buffer(GL_ARRAY_BUFFER, stream->buffers[stream->current]);
+
+    glBufferSubData(GL_ARRAY_BUFFER, stream->flushed,
+                    stream->offset - stream->flushed,
+                    stream->data + stream->flushed);
+
+    stream->bytes_uploaded += stream->offset - stream->flushed;
+    stream->flushed = stream->offset;
+}
+
+// Uploads bytes straight from data, for vertices that are already in their
+// final layout somewhere else. Sets gl_offset like stream_alloc. Returns false
+// if they won't fit.
+bool stream_upload(StreamBuffer *stream, const void *data, int bytes,
+                   GLintptr *gl_offset)
+{
+    // Anything allocated before goes first, so flushes stay in order
+    stream_flush(stream);
+
+    int offset = stream_reserve(stream, bytes);
+
+    if (offset < 0) {
+        fprintf(stderr, "stream_upload: %d bytes won't fit in stream of %d\n",
+                bytes, stream->size);
+        return false;
+    }
+
+    bind_buffer(GL_ARRAY_BUFFER, stream->buffers[stream->current]);
+    glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, data);
+
+    stream->bytes_uploaded += bytes;
+    stream->flushed = stream->offset;
+
+    *gl_offset = offset;
+
+    return true;
+}
@@ -0,0 +1,509 @@
+// Measures the text path: lays out and draws a few thousand strings of mixed
+// length every frame and prints one line of JSON with glyph and vertex
+// throughput, CPU time per phase and bytes uploaded, so runs can be compared
+// by a script.
+//
+// Options:
+//   --strings N      strings drawn each frame (default 2000)
+//   --min-length N   shortest string in codepoints (default 4)
+//   --max-length N   longest string in codepoints (default 80)
+//   --wrap W         wrap width in pixels, 0 for none (default 0)
+//   --frames N       frames measured, after one warm up frame (default 100)
+//   --seed N         seed for the generated text
+//   --cold           clear the atlas every frame, so every glyph is
+//                    rasterized and uploaded again
+//   --no-vao         draw without vertex array objects, replaying the vertex
+//                    layout on every bind
+//   --sdf            use FONT_SDF fonts
+//   --fonts N        spread the strings over N sizes of the font, which share
+//                    an atlas page (default 1)
+//   --workers N      threads rasterizing the glyphs generated before the
+//                    first frame (default one per core)
+//
+// Native builds also stop after FRAMES frames, so set it above --frames.
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <SDL2/SDL.h>
+#include <GLES2/gl2.h>
+
+#include "platform.c"
+#include "maths.c"
+#include "sdl.c"
+#include "gl.c"
+#include "stream.c"
+#include "vertex_format.c"
+#include "batch.c"
+#include "jobs.c"
+#include "font.c"
+#include "font_manager.c"
+#include "layout.c"
+#include "text_renderer.c"
+#include "random.c"
+
+#define BENCH_FONT_SIZE 30
+#define BENCH_SDF_FONT_SIZE 24
+#define BENCH_FONT_SIZE_STEP 2
+#define BENCH_MAX_CODEPOINT_BYTES 2
+#define BENCH_COLOURS_COUNT 4
+
+typedef enum BenchPhase
+{
+    PHASE_LAYOUT,
+    PHASE_ATLAS_UPLOAD,
+    PHASE_SUBMIT,
+    PHASE_FINISH,
+    PHASES_COUNT,
+} BenchPhase;
+
+const char *phase_names[PHASES_COUNT] = {
+    "layout",
+    "atlas_upload",
+    "submit",
+    "finish",
+};
+
+// Strings cycle through these, packed as pack_colour does. They shouldn't cost
+// any draw calls.
+const uint32_t string_colours[BENCH_COLOURS_COUNT] = {
+    0xFFFFFFFF,
+    0xFF5AD2FF,
+    0xFFFFE1C8,
+    0xFF96FF96,
+};
+
+// Everything generate_strings can choose from
+static const uint32_t preload_ranges[][2] = {
+    {' ', ' '},
+    {'0', '9'},
+    {'A', 'Z'},
+    {'a', 'z'},
+    {0xC0, 0xFF},
+};
+
+typedef struct Totals
+{
+    double phase_ms[PHASES_COUNT];
+    uint64_t glyphs;
+    uint64_t draw_calls;
+    uint64_t glyphs_rasterized;
+    uint64_t vertex_bytes;
+    uint64_t atlas_bytes;
+    uint64_t gl_calls_made;
+    uint64_t gl_calls_saved;
+} Totals;
+
+typedef struct Globals
+{
+    SDL sdl;
+    TextRenderer renderer;
+    FontManager fonts;
+    FontHandle font_handles[MAX_PAGE_FONTS];
+    JobSystem jobs;
+    int window_width;
+    int window_height;
+
+    // Options
+    int strings_count;
+    int min_length;
+    int max_length;
+    float wrap_width;
+    int frames;
+    uint64_t seed;
+    bool cold;
+    bool vertex_arrays;
+    FontMode font_mode;
+    int fonts_count;
+    int workers_count;
+
+    char **strings;
+    TextLayout *layouts;
+
+    double preload_ms;
+    int frame;
+    Totals totals;
+} Globals;
+
+// Writes codepoint as UTF-8. Only codepoints below 0x800 are generated.
+char *encode_utf8(char *out, uint32_t codepoint)
+{
+    if (codepoint < 0x80) {
+        *out++ = codepoint;
+    } else {
+        *out++ = 0xC0 | (codepoint >> 6);
+        *out++ = 0x80 | (codepoint & 0x3F);
+    }
+
+    return out;
+}
+
+// Words of lower case ASCII with the odd capital, digit and Latin-1 letter
+bool generate_strings(Globals *globals)
+{
+    Random random;
+    seed_random(&random, globals->seed);
+
+    globals->strings = malloc(globals->strings_count *
+                              sizeof(*globals->strings));
+    if (!globals->strings) return false;
+
+    uint32_t bits[RANDOM_LANES];
+
+    for (int i = 0; i < globals->strings_count; ++i) {
+        next_random_block(&random, bits);
+
+        int length = globals->min_length +
+                     bits[0] % (globals->max_length - globals->min_length + 1);
+
+        char *s = malloc(length * BENCH_MAX_CODEPOINT_BYTES + 1);
+        if (!s) return false;
+
+        globals->strings[i] = s;
+
+        for (int j = 0; j < length; ++j) {
+            next_random_block(&random, bits);
+
+            uint32_t codepoint;
+
+            switch (bits[0] % 16) {
+            case 0:
+            case 1:
+            case 2:
+                codepoint = ' ';
+                break;
+            case 3:
+                codepoint = 'A' + bits[1] % 26;
+                break;
+            case 4:
+                codepoint = '0' + bits[1] % 10;
+                break;
+            case 5:
+                codepoint = 0xC0 + bits[1] % 0x40;
+                break;
+            default:
+                codepoint = 'a' + bits[1] % 26;
+                break;
+            }
+
+            s = encode_utf8(s, codepoint);
+        }
+
+        *s = '\0';
+    }
+
+    globals->layouts = calloc(globals->strings_count,
+                              sizeof(*globals->layouts));
+
+    return globals->layouts != NULL;
+}
+
+void print_results(Globals *globals)
+{
+    Totals *totals = &globals->totals;
+    double frames = globals->frames;
+
+    double total_ms = 0;
+    for (int i = 0; i < PHASES_COUNT; ++i) total_ms += totals->phase_ms[i];
+
+    double seconds = total_ms / 1000.0;
+    uint64_t vertices = totals->glyphs * BATCH_QUAD_VERTICES;
+
+    printf("{\"benchmark\":\"text\",\"mode\":\"%s\",\"atlas\":\"%s\","
+           "\"strings\":%d,\"min_length\":%d,\"max_length\":%d,"
+           "\"wrap_width\":%g,\"frames\":%d,\"fonts\":%d,\"workers\":%d,"
+           "\"vertex_arrays\":%s,\"preload_ms\":%.3f,",
+           globals->font_mode == FONT_SDF ? "sdf" : "bitmap",
+           globals->cold ? "cold" : "warm", globals->strings_count,
+           globals->min_length, globals->max_length, globals->wrap_width,
+           globals->frames, globals->fonts_count, globals->jobs.workers_count,
+           globals->vertex_arrays ? "true" : "false", globals->preload_ms);
+
+    printf("\"glyphs_per_frame\":%.1f,\"glyphs_per_second\":%.0f,"
+           "\"vertices_per_second\":%.0f,\"draw_calls_per_frame\":%.1f,"
+           "\"glyphs_rasterized_per_frame\":%.1f,",
+           totals->glyphs / frames, seconds > 0 ? totals->glyphs / seconds : 0,
+           seconds > 0 ? vertices / seconds : 0, totals->draw_calls / frames,
+           totals->glyphs_rasterized / frames);
+
+    printf("\"ms_per_frame\":{");
+    for (int i = 0; i < PHASES_COUNT; ++i) {
+        printf("\"%s\":%.4f,", phase_names[i], totals->phase_ms[i] / frames);
+    }
+    printf("\"total\":%.4f},", total_ms / frames);
+
+    printf("\"state_calls_per_frame\":{\"made\":%.1f,\"saved\":%.1f},",
+           totals->gl_calls_made / frames, totals->gl_calls_saved / frames);
+
+    printf("\"bytes_uploaded_per_frame\":{\"vertices\":%.0f,\"atlas\":%.0f}}\n",
+           totals->vertex_bytes / frames, totals->atlas_bytes / frames);
+
+    fflush(stdout);
+}
+
+// Adds up the counters over every atlas page and batch
+void count_uploads(Globals *globals, Totals *counts)
+{
+    FontManager *fonts = &globals->fonts;
+    TextRenderer *renderer = &globals->renderer;
+
+    memset(counts, 0, sizeof(*counts));
+
+    for (int i = 0; i < fonts->pages_count; ++i) {
+        counts->glyphs_rasterized += fonts->pages[i].glyphs_rasterized;
+        counts->atlas_bytes += fonts->pages[i].bytes_uploaded;
+    }
+
+    for (int i = 0; i < MAX_ATLAS_PAGES; ++i) {
+        counts->draw_calls += renderer->batches[i].draw_calls;
+        counts->vertex_bytes += renderer->batches[i].stream.bytes_uploaded;
+    }
+}
+
+Font *get_string_font(Globals *globals, int string)
+{
+    return get_font(&globals->fonts,
+                    globals->font_handles[string % globals->fonts_count]);
+}
+
+EM_BOOL main_loop(double time, void *user_data)
+{
+    Globals *globals = (Globals *)user_data;
+    TextRenderer *renderer = &globals->renderer;
+    FontManager *fonts = &globals->fonts;
+
+    Totals before;
+    count_uploads(globals, &before);
+
+    uint64_t glyphs = 0;
+
+    reset_gl_state_counters();
+
+    double phase_ms[PHASES_COUNT];
+    double start = get_time();
+
+    // Layout, rasterizing anything not in the atlas
+    {
+        if (globals->cold) {
+            for (int i = 0; i < fonts->pages_count; ++i) {
+                clear_atlas_page(&fonts->pages[i]);
+            }
+        }
+
+        begin_fonts_frame(fonts);
+
+        for (int i = 0; i < globals->strings_count; ++i) {
+            TextLayout *layout = &globals->layouts[i];
+
+            layout_text(layout, get_string_font(globals, i),
+                        globals->strings[i], 1.0f, globals->wrap_width);
+
+            glyphs += layout->glyphs_count;
+        }
+
+        double now = get_time();
+        phase_ms[PHASE_LAYOUT] = now - start;
+        start = now;
+    }
+
+    // Atlas upload
+    {
+        flush_fonts(fonts);
+
+        double now = get_time();
+        phase_ms[PHASE_ATLAS_UPLOAD] = now - start;
+        start = now;
+    }
+
+    // Submit
+    {
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        begin_text_frame(renderer);
+
+        for (int i = 0; i < globals->strings_count; ++i) {
+            float x = (i * 97) % globals->window_width;
+            float y = (i * 31) % globals->window_height;
+
+            draw_text_layout(renderer, get_string_font(globals, i),
+                             &globals->layouts[i], x, y,
+                             string_colours[i % BENCH_COLOURS_COUNT]);
+        }
+
+        end_text_frame(renderer);
+
+        double now = get_time();
+        phase_ms[PHASE_SUBMIT] = now - start;
+        start = now;
+    }
+
+    // Wait for the GPU, so its time isn't hidden in a later frame
+    {
+        glFinish();
+
+        phase_ms[PHASE_FINISH] = get_time() - start;
+    }
+
+    swap_sdl_window(&globals->sdl);
+
+    // The first frame fills the atlas and warms the driver up, so it isn't
+    // counted
+    if (globals->frame++ > 0) {
+        Totals *totals = &globals->totals;
+
+        Totals after;
+        count_uploads(globals, &after);
+
+        for (int i = 0; i < PHASES_COUNT; ++i) {
+            totals->phase_ms[i] += phase_ms[i];
+        }
+
+        // Draw calls are counted from zero every frame
+        totals->glyphs += glyphs;
+        totals->draw_calls += after.draw_calls;
+        totals->glyphs_rasterized +=
+            after.glyphs_rasterized - before.glyphs_rasterized;
+        totals->vertex_bytes += after.vertex_bytes - before.vertex_bytes;
+        totals->atlas_bytes += after.atlas_bytes - before.atlas_bytes;
+        totals->gl_calls_made += gl_state.calls_made;
+        totals->gl_calls_saved += gl_state.calls_saved;
+    }
+
+    if (globals->frame > globals->frames) {
+        print_results(globals);
+        cleanup_sdl(&globals->sdl);
+        return EM_FALSE;
+    }
+
+    return EM_TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+    Globals *globals = malloc(sizeof(*globals));
+    memset(globals, 0, sizeof(*globals));
+    globals->window_width = 640;
+    globals->window_height = 480;
+    globals->strings_count = 2000;
+    globals->min_length = 4;
+    globals->max_length = 80;
+    globals->frames = 100;
+    globals->seed = 1;
+    globals->font_mode = FONT_BITMAP;
+    globals->fonts_count = 1;
+    globals->workers_count = count_cores();
+    globals->vertex_arrays = true;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--sdf") == 0) {
+            globals->font_mode = FONT_SDF;
+        } else if (strcmp(argv[i], "--cold") == 0) {
+            globals->cold = true;
+        } else if (strcmp(argv[i], "--no-vao") == 0) {
+            globals->vertex_arrays = false;
+        } else if (i + 1 < argc) {
+            const char *value = argv[i + 1];
+
+            if (strcmp(argv[i], "--strings") == 0) {
+                globals->strings_count = atoi(value);
+            } else if (strcmp(argv[i], "--min-length") == 0) {
+                globals->min_length = atoi(value);
+            } else if (strcmp(argv[i], "--max-length") == 0) {
+                globals->max_length = atoi(value);
+            } else if (strcmp(argv[i], "--wrap") == 0) {
+                globals->wrap_width = atof(value);
+            } else if (strcmp(argv[i], "--frames") == 0) {
+                globals->frames = atoi(value);
+            } else if (strcmp(argv[i], "--seed") == 0) {
+                globals->seed = strtoull(value, NULL, 0);
+            } else if (strcmp(argv[i], "--fonts") == 0) {
+                globals->fonts_count = atoi(value);
+            } else if (strcmp(argv[i], "--workers") == 0) {
+                globals->workers_count = atoi(value);
+            } else {
+                continue;
+            }
+
+            ++i;
+        }
+    }
+
+    if (globals->strings_count < 1 || globals->frames < 1 ||
+        globals->min_length < 1 || globals->max_length < globals->min_length ||
+        globals->fonts_count < 1 || globals->fonts_count > MAX_PAGE_FONTS) {
+        fprintf(stderr, "text_bench: bad options\n");
+        return 1;
+    }
+
+    if (!generate_strings(globals)) {
+        fprintf(stderr, "text_bench: out of memory\n");
+        return 1;
+    }
+
+    if (!setup_sdl(&globals->sdl, globals->window_width,
+                   globals->window_height)) {
+        cleanup_sdl(&globals->sdl);
+        return 1;
+    }
+
+    // Setup Renderer
+    {
+        glEnable(GL_BLEND);
+
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        glClearColor(0.1, 0.3, 0.5, 1.0);
+
+        set_active_texture(0);
+
+        if (!create_font_manager(&globals->fonts)) return 1;
+
+        // Distance fields take more room, so the SDF size is smaller to fit
+        // everything generated in the atlas
+        int size = globals->font_mode == FONT_SDF ? BENCH_SDF_FONT_SIZE :
+                                                    BENCH_FONT_SIZE;
+
+        for (int i = 0; i < globals->fonts_count; ++i) {
+            FontHandle handle =
+                add_font(&globals->fonts, "assets/fonts/NovaMono-Regular.ttf",
+                         size - i * BENCH_FONT_SIZE_STEP, globals->font_mode);
+            if (handle == NO_FONT) return 1;
+
+            globals->font_handles[i] = handle;
+        }
+
+        // Setup Glyphs
+        {
+            start_job_system(&globals->jobs, globals->workers_count);
+
+            double start = get_time();
+
+            preload_fonts(&globals->fonts, &globals->jobs, preload_ranges,
+                          sizeof(preload_ranges) / sizeof(preload_ranges[0]));
+
+            flush_fonts(&globals->fonts);
+            glFinish();
+
+            globals->preload_ms = get_time() - start;
+
+            stop_job_system(&globals->jobs);
+        }
+
+        if (globals->vertex_arrays) {
+            globals->vertex_arrays = load_vertex_array_objects();
+        }
+
+        if (!create_text_renderer(&globals->renderer, globals->window_width,
+                                  globals->window_height)) {
+            return 1;
+        }
+
+        glReleaseShaderCompiler();
+    }
+
+    run_frame_loop(main_loop, globals);
+
+    return 0;
+}
@@ -0,0 +1,468 @@
+// Draws text from fonts' atlas pages: strings laid out each frame through a
+// quad batch per page, and text runs that keep their vertices in a buffer of
+// their own until the text changes.
+//
+// Strings drawn between begin_text_frame and end_text_frame are batched by
+// page rather than in order, so text in any number of fonts on a page takes
+// one draw call, but text on one page can't overlap text on another. A page's
+// new glyphs are uploaded whenever its batch or a run on it is drawn, so
+// text can be drawn before or after flush_fonts.
+
+#define POSITION_ATTRIBUTE_LOCATION 0
+#define TEXCOORD_ATTRIBUTE_LOCATION 1
+#define COLOUR_ATTRIBUTE_LOCATION 2
+#define POSITION_COMPONENTS 2
+#define TEXCOORD_COMPONENTS 2
+#define COLOUR_COMPONENTS 4
+#define VERTEX_BYTES (sizeof(GlyphVertex))
+#define QUAD_BYTES (BATCH_QUAD_VERTICES * VERTEX_BYTES)
+#define BATCH_QUADS 1024
+#define MAX_TEXT_RUNS 16
+#define MAX_RUN_QUADS 1024
+
+// Positions are whole pixels, passed to the shader as they are. Texcoords
+// come normalized from the glyph and the colour is packed with pack_colour,
+// so the fragment shader has nothing to work out before sampling.
+typedef struct GlyphVertex
+{
+    int16_t x;
+    int16_t y;
+    uint16_t u;
+    uint16_t v;
+    uint32_t colour;
+} GlyphVertex;
+
+// Text that's drawn from the same vertices every frame until it changes. Each
+// run owns a range of the renderer's run buffer and pins the glyphs it uses,
+// so their texture coordinates stay valid.
+typedef struct TextRun
+{
+    uint64_t hash;
+    AtlasPage *page;
+    int first_quad;
+    int quads_size;
+    int quad_count;
+    Glyph **glyphs;
+    int glyphs_count;
+
+    // The glyphs pinned by the previous layout, while the next is pinned
+    Glyph **old_glyphs;
+} TextRun;
+
+typedef struct TextRenderer
+{
+    GLuint programs[FONT_MODES_COUNT];
+    Batch batches[MAX_ATLAS_PAGES];
+    VertexFormat vertex_format;
+
+    // Scratch layout for draw_string
+    TextLayout layout;
+
+    // While a run is being laid out its quads go here rather than the batch
+    TextRun *layout_run;
+    GlyphVertex *run_vertices;
+    int run_quad_count;
+
+    GLuint run_buffer;
+    VertexArray run_array;
+    TextRun runs[MAX_TEXT_RUNS];
+    int runs_count;
+    int run_quads_used;
+} TextRenderer;
+
+// Where the next quad's vertices go. Returns NULL if a run being laid out is
+// full.
+GlyphVertex *next_quad(TextRenderer *renderer, AtlasPage *page)
+{
+    if (!renderer->layout_run) {
+        Batch *batch = &renderer->batches[page->index];
+        batch->before_draw_data = page;
+
+        return batch_quad(batch, renderer->programs[page->mode],
+                          page->texture);
+    }
+
+    if (renderer->run_quad_count == renderer->layout_run->quads_size) {
+        return NULL;
+    }
+
+    return renderer->run_vertices +
+           renderer->run_quad_count++ * BATCH_QUAD_VERTICES;
+}
+
+void draw_glyph(TextRenderer *renderer, Font *font, Glyph *glyph, float x,
+                float y, float scale, uint32_t colour)
+{
+    GlyphVertex *vertex = next_quad(renderer, font->page);
+    if (!vertex) return;
+
+    int16_t l = x;
+    int16_t t = y;
+    int16_t r = x + glyph->width * scale;
+    int16_t b = y + glyph->height * scale;
+
+    vertex[0] = (GlyphVertex){l, t, glyph->u0, glyph->v0, colour};
+    vertex[1] = (GlyphVertex){r, t, glyph->u1, glyph->v0, colour};
+    vertex[2] = (GlyphVertex){r, b, glyph->u1, glyph->v1, colour};
+    vertex[3] = (GlyphVertex){l, b, glyph->u0, glyph->v1, colour};
+}
+
+// colour is made with pack_colour. Text in any colour batches together.
+void draw_text_layout(TextRenderer *renderer, Font *font,
+                      const TextLayout *layout, float x, float y,
+                      uint32_t colour)
+{
+    for (int i = 0; i < layout->glyphs_count; ++i) {
+        const LaidOutGlyph *laid_out = &layout->glyphs[i];
+        Glyph *glyph = laid_out->glyph;
+
+        // Only look it up again if something was evicted since
+        if (layout->generation == font->page->generation) {
+            glyph->last_used = font->page->frame;
+        } else {
+            glyph = get_glyph(font, laid_out->codepoint);
+            if (!glyph) continue;
+        }
+
+        draw_glyph(renderer, font, glyph, x + laid_out->x, y + laid_out->y,
+                   layout->scale, colour);
+    }
+}
+
+// Wraps at wrap_width unless it's 0. scale only looks right for FONT_SDF
+// fonts; bitmap glyphs get blurry.
+void draw_string(TextRenderer *renderer, Font *font, const char *s, float x,
+                 float y, float scale, float wrap_width, uint32_t colour)
+{
+    if (!layout_text(&renderer->layout, font, s, scale, wrap_width)) return;
+
+    draw_text_layout(renderer, font, &renderer->layout, x, y, colour);
+}
+
+// Reserves room in the run buffer for up to quads_size glyphs. Returns NULL
+// if there's no room left.
+TextRun *create_text_run(TextRenderer *renderer, int quads_size)
+{
+    if (renderer->runs_count == MAX_TEXT_RUNS ||
+        renderer->run_quads_used + quads_size > MAX_RUN_QUADS) {
+        fprintf(stderr, "create_text_run: no room for %d quads\n",
+                quads_size);
+        return NULL;
+    }
+
+    TextRun *run = &renderer->runs[renderer->runs_count++];
+
+    run->glyphs = malloc(quads_size * sizeof(*run->glyphs));
+    run->old_glyphs = malloc(quads_size * sizeof(*run->old_glyphs));
+    if (!run->glyphs || !run->old_glyphs) {
+        fprintf(stderr, "create_text_run: out of memory\n");
+        free(run->glyphs);
+        free(run->old_glyphs);
+        --renderer->runs_count;
+        return NULL;
+    }
+
+    run->hash = 0;
+    run->page = NULL;
+    run->first_quad = renderer->run_quads_used;
+    run->quads_size = quads_size;
+    run->quad_count = 0;
+    run->glyphs_count = 0;
+
+    renderer->run_quads_used += quads_size;
+
+    return run;
+}
+
+// FNV-1a over everything that changes a run's vertices
+uint64_t hash_text_run(Font *font, const char *s, float x, float y,
+                       float scale, float wrap_width, uint32_t colour)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    for (; *s; ++s) {
+        hash = (hash ^ (uint8_t)*s) * 0x100000001B3ull;
+    }
+
+    const void *keys[] = {&font, &x, &y, &scale, &wrap_width, &colour};
+    const int sizes[] = {sizeof(font),  sizeof(x),          sizeof(y),
+                         sizeof(scale), sizeof(wrap_width), sizeof(colour)};
+
+    for (int i = 0; i < 6; ++i) {
+        const uint8_t *bytes = keys[i];
+
+        for (int j = 0; j < sizes[i]; ++j) {
+            hash = (hash ^ bytes[j]) * 0x100000001B3ull;
+        }
+    }
+
+    return hash;
+}
+
+// Lays the run out again only if its text, font, position or colour changed.
+void set_text_run(TextRenderer *renderer, TextRun *run, Font *font,
+                  const char *s, float x, float y, float scale,
+                  float wrap_width, uint32_t colour)
+{
+    uint64_t hash = hash_text_run(font, s, x, y, scale, wrap_width, colour);
+    if (hash == run->hash) return;
+
+    run->hash = hash;
+    run->page = font->page;
+
+    // Lay it out on the side, then move it over
+    renderer->layout_run = run;
+    renderer->run_quad_count = 0;
+
+    draw_string(renderer, font, s, x, y, scale, wrap_width, colour);
+
+    renderer->layout_run = NULL;
+
+    bind_buffer(GL_ARRAY_BUFFER, renderer->run_buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, run->first_quad * QUAD_BYTES,
+                    renderer->run_quad_count * QUAD_BYTES,
+                    renderer->run_vertices);
+
+    run->quad_count = renderer->run_quad_count;
+
+    // Pin the new glyphs before letting go of the old ones, as most will be
+    // the same
+    Glyph **old_glyphs = run->glyphs;
+    int old_count = run->glyphs_count;
+
+    run->glyphs = run->old_glyphs;
+    run->old_glyphs = old_glyphs;
+    run->glyphs_count = 0;
+
+    const TextLayout *layout = &renderer->layout;
+
+    for (int i = 0; i < layout->glyphs_count && i < run->quads_size; ++i) {
+        Glyph *glyph = layout->glyphs[i].glyph;
+
+        pin_glyph(glyph);
+        run->glyphs[run->glyphs_count++] = glyph;
+    }
+
+    for (int i = 0; i < old_count; ++i) unpin_glyph(old_glyphs[i]);
+}
+
+void draw_text_run(TextRenderer *renderer, TextRun *run)
+{
+    if (run->quad_count == 0) return;
+
+    // Keep anything batched before it underneath
+    for (int i = 0; i < MAX_ATLAS_PAGES; ++i) {
+        flush_batch(&renderer->batches[i]);
+    }
+
+    flush_atlas_page(run->page);
+
+    use_program(renderer->programs[run->page->mode]);
+    bind_texture(0, run->page->texture);
+
+    bind_vertex_array(&renderer->run_array, run->first_quad * QUAD_BYTES);
+
+    glDrawElements(GL_TRIANGLES, run->quad_count * BATCH_QUAD_INDICES,
+                   GL_UNSIGNED_SHORT, 0);
+}
+
+// Links the program for mode's pages, with a pixel projection for a width by
+// height viewport. Returns 0 on failure.
+GLuint create_text_program(FontMode mode, int width, int height)
+{
+    const char vertex_shader_code[] =
+        "uniform mat4 projection;\n"
+        "attribute vec2 position;\n"
+        "attribute vec2 tex_coord;\n"
+        "attribute vec4 colour;\n"
+        "varying vec2 varying_tex_coord;\n"
+        "varying vec4 varying_colour;\n"
+        "\n"
+        "void main()\n"
+        "{\n"
+        "    gl_Position = vec4(position.xy, 0.0, 1.0) * projection;\n"
+        "    varying_tex_coord = tex_coord;\n"
+        "    varying_colour = colour;\n"
+        "}";
+
+    const char fragment_shader_code[] =
+        "precision mediump float;\n"
+        "varying vec2 varying_tex_coord;\n"
+        "varying lowp vec4 varying_colour;\n"
+        "uniform sampler2D sampler;\n"
+        "\n"
+        "void main()\n"
+        "{\n"
+        "    lowp vec4 t = texture2D(sampler, varying_tex_coord);\n"
+        "    gl_FragColor =\n"
+        "        vec4(varying_colour.rgb, varying_colour.a * t.a);\n"
+        "}";
+
+    // Thresholds the distance at the outline, blending over about a pixel on
+    // screen whatever the scale
+    const char sdf_fragment_shader_code[] =
+        "#ifdef GL_OES_standard_derivatives\n"
+        "#extension GL_OES_standard_derivatives : enable\n"
+        "#endif\n"
+        "precision mediump float;\n"
+        "varying vec2 varying_tex_coord;\n"
+        "varying lowp vec4 varying_colour;\n"
+        "uniform sampler2D sampler;\n"
+        "\n"
+        "void main()\n"
+        "{\n"
+        "    float distance = texture2D(sampler, varying_tex_coord).a;\n"
+        "#ifdef GL_OES_standard_derivatives\n"
+        "    float smoothing = 0.7 * fwidth(distance);\n"
+        "#else\n"
+        "    float smoothing = 0.05;\n"
+        "#endif\n"
+        "    float alpha =\n"
+        "        smoothstep(0.5 - smoothing, 0.5 + smoothing, distance);\n"
+        "    gl_FragColor =\n"
+        "        vec4(varying_colour.rgb, varying_colour.a * alpha);\n"
+        "}";
+
+    GLuint program = create_shader_program_from_code(
+        vertex_shader_code, mode == FONT_SDF ? sdf_fragment_shader_code :
+                                               fragment_shader_code);
+
+    if (program == 0) return 0;
+
+    glBindAttribLocation(program, POSITION_ATTRIBUTE_LOCATION, "position");
+    glBindAttribLocation(program, TEXCOORD_ATTRIBUTE_LOCATION, "tex_coord");
+    glBindAttribLocation(program, COLOUR_ATTRIBUTE_LOCATION, "colour");
+
+    if (!link_shader_program(program)) {
+        return 0;
+    }
+
+    use_program(program);
+
+    // Uniforms
+    float l = 0.0f;
+    float b = height;
+    float r = width;
+    float t = 0.0f;
+
+    {
+        GLint location = glGetUniformLocation(program, "sampler");
+
+        glUniform1i(location, 0);
+
+        location = glGetUniformLocation(program, "projection");
+
+        float n = -1.0f;
+        float f = 1.0f;
+
+        // Orthographic projection matrix based on glOrtho, see
+        // registry.khronos.org/OpenGL-Refpages/gl2.1/xhtml/glOrtho.xml
+        float projection_matrix[] = {
+            // row 1
+            2.0f / (r - l),
+            0.0f,
+            0.0f,
+            -((r + l) / (r - l)),
+
+            // row 2
+            0.0f,
+            2.0f / (t - b),
+            0.0f,
+            -((t + b) / (t - b)),
+
+            // row 3
+            0.0f,
+            0.0f,
+            (-2.0f) / (f - n),
+            -((f + n) / (f - n)),
+
+            // row 4
+            0.0f,
+            0.0f,
+            0.0f,
+            1.0f,
+        };
+
+        glUniformMatrix4fv(location, 1, GL_FALSE, projection_matrix);
+    }
+
+    return program;
+}
+
+// Each batch's before_draw, for glyphs rasterized since flush_fonts
+void flush_batch_page(void *page)
+{
+    flush_atlas_page(page);
+}
+
+bool create_text_renderer(TextRenderer *renderer, int width, int height)
+{
+    for (int mode = 0; mode < FONT_MODES_COUNT; ++mode) {
+        renderer->programs[mode] = create_text_program(mode, width, height);
+
+        if (renderer->programs[mode] == 0) return false;
+    }
+
+    // Setup Batches
+    {
+        add_vertex_attribute(&renderer->vertex_format,
+                             POSITION_ATTRIBUTE_LOCATION, POSITION_COMPONENTS,
+                             GL_SHORT, GL_FALSE);
+
+        add_vertex_attribute(&renderer->vertex_format,
+                             TEXCOORD_ATTRIBUTE_LOCATION, TEXCOORD_COMPONENTS,
+                             GL_UNSIGNED_SHORT, GL_TRUE);
+
+        add_vertex_attribute(&renderer->vertex_format,
+                             COLOUR_ATTRIBUTE_LOCATION, COLOUR_COMPONENTS,
+                             GL_UNSIGNED_BYTE, GL_TRUE);
+
+        assert(renderer->vertex_format.stride == VERTEX_BYTES);
+
+        // The text is small, so orphaning one buffer is enough
+        for (int i = 0; i < MAX_ATLAS_PAGES; ++i) {
+            if (!create_batch(&renderer->batches[i], &renderer->vertex_format,
+                              BATCH_QUADS, STREAM_ORPHAN)) {
+                return false;
+            }
+
+            renderer->batches[i].before_draw = flush_batch_page;
+        }
+    }
+
+    // Setup Text Runs
+    {
+        glGenBuffers(1, &renderer->run_buffer);
+        bind_buffer(GL_ARRAY_BUFFER, renderer->run_buffer);
+        glBufferData(GL_ARRAY_BUFFER, MAX_RUN_QUADS * QUAD_BYTES, NULL,
+                     GL_DYNAMIC_DRAW);
+
+        // Runs are drawn with the batch's indices, so none can be longer
+        assert(MAX_RUN_QUADS <= BATCH_QUADS);
+
+        create_vertex_array(&renderer->run_array, &renderer->vertex_format,
+                            renderer->run_buffer,
+                            renderer->batches[0].index_buffer);
+
+        renderer->run_vertices = malloc(MAX_RUN_QUADS * QUAD_BYTES);
+        if (!renderer->run_vertices) return false;
+    }
+
+    return true;
+}
+
+void begin_text_frame(TextRenderer *renderer)
+{
+    for (int i = 0; i < MAX_ATLAS_PAGES; ++i) {
+        begin_batch(&renderer->batches[i]);
+    }
+}
+
+// Draws anything drawn with draw_string since begin_text_frame, a page at a
+// time
+void end_text_frame(TextRenderer *renderer)
+{
+    for (int i = 0; i < MAX_ATLAS_PAGES; ++i) {
+        flush_batch(&renderer->batches[i]);
+    }
+}
@@ -3,18 +3,27 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-#include <ft2build.h>
-#include FT_FREETYPE_H
-
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_mixer.h>
 #include <GLES2/gl2.h>
 
-#include <emscripten.h>
-#include <emscripten/html5.h>
-
+#include "platform.c"
 #include "gl.c"
+#include "image.c"
+#include "stream.c"
+#include "vertex_format.c"
+#include "batch.c"
+
+#define SPRITE_BATCH_QUADS 64
+
+typedef struct SpriteVertex
+{
+    float x;
+    float y;
+    float u;
+    float v;
+} SpriteVertex;
 
 SDL_Window *window;
 SDL_GLContext glcontext;
@@ -31,30 +40,13 @@ float camera_x = 0;
 float camera_y = 0;
 
 GLuint texture = 0;
-GLuint program_object = 0;
-GLuint vertex_pos_buffer, texcoord_buffer;
+Program program;
+Batch sprite_batch;
 
 Mix_Music *music = NULL;
 Mix_Chunk *wave = NULL;
 int channel = -1;
 
-FT_Library library;
-GLuint font = 0;
-
-// https://graphics.stanford.edu/~seander/bithacks.html#RoundUpPowerOf2
-uint32_t round_up_to_power_of_two(uint32_t v)
-{
-    v--;
-    v |= v >> 1;
-    v |= v >> 2;
-    v |= v >> 4;
-    v |= v >> 8;
-    v |= v >> 16;
-    v++;
-
-    return v;
-}
-
 bool setup_sdl()
 {
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
@@ -91,39 +83,9 @@ bool setup_sdl()
 
     assert(IMG_Init(IMG_INIT_PNG) & IMG_INIT_PNG);
 
-    const char *image_filename = "assets/images/player.png";
-
-    SDL_Surface *surface = IMG_Load(image_filename);
-
-    if (!surface) {
-        fprintf(stderr, "setup_sdl: IMG_Load '%s': %s\n", image_filename,
-                IMG_GetError());
-        return false;
-    }
-
-    if (surface->format->format != SDL_PIXELFORMAT_RGBA32) {
-        SDL_Surface *converted_surface =
-            SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_RGBA32, 0);
-        assert(converted_surface);
-
-        SDL_FreeSurface(surface);
-
-        surface = converted_surface;
-    }
+    texture = load_texture("assets/images/player.png", GL_NEAREST);
 
-    glGenTextures(1, &texture);
-
-    glBindTexture(GL_TEXTURE_2D, texture);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, surface->w, surface->h, 0, GL_RGBA,
-                 GL_UNSIGNED_BYTE, surface->pixels);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-    SDL_FreeSurface(surface);
+    if (!texture) return false;
 
     // SHADERS
     GLuint vertex_shader =
@@ -132,156 +94,37 @@ bool setup_sdl()
     GLuint fragment_shader = load_shader_from_file(
         "assets/shaders/viewport.frag", GL_FRAGMENT_SHADER);
 
-    program_object = glCreateProgram();
+    GLuint program_object =
+        create_shader_program(vertex_shader, fragment_shader);
 
     if (program_object == 0) return false;
 
-    glAttachShader(program_object, vertex_shader);
-    glAttachShader(program_object, fragment_shader);
-
     glBindAttribLocation(program_object, 0, "position");
     glBindAttribLocation(program_object, 1, "tex_coord");
 
-    glLinkProgram(program_object);
-
-    // Check link status
-    GLint linked;
-    glGetProgramiv(program_object, GL_LINK_STATUS, &linked);
-
-    if (!linked) {
-        fprintf(stderr, "setup_sdl: error linking GL program\n");
-        return false;
-    }
+    if (!link_program(&program, program_object)) return false;
 
     glReleaseShaderCompiler();
 
-    // VBOs
-    GLfloat vertices[] = {
-        0.5f,  0.5f,  0.0f,
-
-        -0.5f, 0.5f,  0.0f,
-
-        -0.5f, -0.5f, 0.0f,
-
-        0.5f,  0.5f,  0.0f,
-
-        -0.5f, -0.5f, 0.0f,
-
-        0.5f,  -0.5f, 0.0f,
-    };
-
-    glGenBuffers(1, &vertex_pos_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertex_pos_buffer);
-    glBufferData(GL_ARRAY_BUFFER, 18 * sizeof(*vertices), vertices,
-                 GL_STATIC_DRAW);
-
-    GLfloat tex_coords[] = {
-        1.0f, 0.0f,
-
-        0.0f, 0.0f,
-
-        0.0f, 1.0f,
-
-        1.0f, 0.0f,
-
-        0.0f, 1.0f,
-
-        1.0f, 1.0f,
-    };
-
-    glGenBuffers(1, &texcoord_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, texcoord_buffer);
-    glBufferData(GL_ARRAY_BUFFER, 12 * sizeof(*tex_coords), tex_coords,
-                 GL_STATIC_DRAW);
-
-    // Font
+    // Sprite Batch
     {
-        // TODO get proper error messages for freetype functions
-
-        FT_Error error = FT_Init_FreeType(&library);
-        if (error) printf("setup_sdl: FT_Init_FreeType: %d\n ", error);
-
-        FT_Face face;
+        VertexFormat format = {0};
 
-        error =
-            FT_New_Face(library, "assets/fonts/NovaMono-Regular.ttf", 0, &face);
-        if (error) printf("setup_sdl: FT_New_Face: %d\n ", error);
+        add_vertex_attribute(&format, 0, 2, GL_FLOAT, GL_FALSE);
+        add_vertex_attribute(&format, 1, 2, GL_FLOAT, GL_FALSE);
 
-        /* use 50pt at 100dpi */
-        // TODO get DPI of screen
-        error = FT_Set_Char_Size(face, 50 * 64, 0, 100, 0);
-        if (error) printf("setup_sdl: FT_New_Face: %d\n ", error);
+        assert(format.stride == sizeof(SpriteVertex));
 
-        int visible_ascii_size = ('~' - ' ' + 1);
-        char *visible_ascii = malloc(visible_ascii_size + 1);
+        load_vertex_array_objects();
 
-        char c = ' ';
-        for (int i = 0; i < visible_ascii_size; ++i, ++c) {
-            visible_ascii[i] = c;
-        }
-
-        visible_ascii[visible_ascii_size] = '\0';
-
-        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
-        int max_advance = (face->size->metrics.max_advance >> 6);
-        int max_height = face->size->metrics.height >> 6;
-
-        int font_texture_width =
-            round_up_to_power_of_two(max_advance * visible_ascii_size);
-
-        int font_texture_height = round_up_to_power_of_two(max_height);
-
-        glGenTextures(1, &font);
-
-        glBindTexture(GL_TEXTURE_2D, font);
-
-        // TODO This suppresses a warning emitted by WebGL, see if we can
-        // replace or work around it
-        uint8_t *buffer = malloc(font_texture_width * font_texture_height);
-        memset(buffer, 0, font_texture_width * font_texture_height);
-
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, font_texture_width,
-                     font_texture_height, 0, GL_ALPHA, GL_UNSIGNED_BYTE,
-                     buffer);
-
-        free(buffer);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-        const char *glyphs = visible_ascii;
-        int glyph_index;
-
-        for (int i = 0; i < visible_ascii_size; ++i, ++glyphs) {
-            glyph_index = FT_Get_Char_Index(face, *glyphs);
-
-            error = FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
-            if (error) printf("setup_sdl: FT_Load_Glyph: %d\n ", error);
-
-            error = FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);
-            if (error) printf("setup_sdl: FT_Render_Glyph: %d\n ", error);
-
-            if (!face->glyph->bitmap.buffer) continue;
-
-            glTexSubImage2D(GL_TEXTURE_2D, 0, i * max_advance, 0, max_advance,
-                            max_height, GL_ALPHA, GL_UNSIGNED_BYTE,
-                            face->glyph->bitmap.buffer);
+        if (!create_batch(&sprite_batch, &format, SPRITE_BATCH_QUADS,
+                          STREAM_ORPHAN)) {
+            return false;
         }
     }
 
     // Audio
-    int frequency = frequency = EM_ASM_INT_V({
-        var context;
-        try {
-            context = new AudioContext();
-        } catch (e) {
-            context = new webkitAudioContext(); // safari only
-        }
-        return context.sampleRate;
-    });
+    int frequency = get_audio_frequency();
 
     if (Mix_OpenAudio(frequency, MIX_DEFAULT_FORMAT, 2, 4096) == -1) {
         fprintf(stderr, "setup_sdl: Mix_OpenAudio: %s\n", Mix_GetError());
@@ -371,35 +214,30 @@ EM_BOOL main_loop(double time, void *user_data)
         glClearColor(0.3, 0.3, 0.4, 1.0);
         glClear(GL_COLOR_BUFFER_BIT);
 
-        glUseProgram(program_object);
+        use_program(program.object);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
+        set_active_texture(0);
 
         // Uniforms
         {
-            GLint location =
-                glGetUniformLocation(program_object, "translation");
-
-            glUniform4f(location, camera_x, camera_y, 0, 0);
+            set_uniform_vec4(&program, "translation", camera_x, camera_y, 0,
+                             0);
 
-            location = glGetUniformLocation(program_object, "sampler");
-
-            glUniform1i(location, 0);
+            set_uniform_int(&program, "sampler", 0);
         }
 
-        // Pass positions to shader
-        glBindBuffer(GL_ARRAY_BUFFER, vertex_pos_buffer);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(0);
+        // Draw
+        begin_batch(&sprite_batch);
+
+        SpriteVertex *vertex =
+            batch_quad(&sprite_batch, program.object, texture);
 
-        // Pass tex_coords to shader
-        glBindBuffer(GL_ARRAY_BUFFER, texcoord_buffer);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(1);
+        vertex[0] = (SpriteVertex){-0.5f, 0.5f, 0.0f, 0.0f};
+        vertex[1] = (SpriteVertex){0.5f, 0.5f, 1.0f, 0.0f};
+        vertex[2] = (SpriteVertex){0.5f, -0.5f, 1.0f, 1.0f};
+        vertex[3] = (SpriteVertex){-0.5f, -0.5f, 0.0f, 1.0f};
 
-        // Draw
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        flush_batch(&sprite_batch);
     }
 
     SDL_GL_SwapWindow(window);
@@ -416,9 +254,9 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    frame_start_time = emscripten_performance_now();
+    frame_start_time = get_time();
 
-    emscripten_request_animation_frame_loop(main_loop, NULL);
+    run_frame_loop(main_loop, NULL);
 
     return 0;
 }
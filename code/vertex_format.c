@@ -0,0 +1,191 @@
+// Describes how the vertices in a buffer are laid out, so the
+// glVertexAttribPointer calls that match a packed layout live in one place.
+// Attributes are added in order and each is padded to a 4 byte boundary, as
+// WebGL requires offsets and strides to be multiples of the component size.
+
+#define MAX_VERTEX_ATTRIBUTES 8
+
+typedef struct VertexAttribute
+{
+    GLuint location;
+    GLint components;
+    GLenum type;
+    GLboolean normalized;
+    int offset;
+} VertexAttribute;
+
+typedef struct VertexFormat
+{
+    VertexAttribute attributes[MAX_VERTEX_ATTRIBUTES];
+    int attributes_count;
+    int stride;
+} VertexFormat;
+
+int vertex_component_bytes(GLenum type)
+{
+    switch (type) {
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE:
+        return 1;
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+        return 2;
+    case GL_FLOAT:
+        return 4;
+    }
+
+    assert(!"vertex_component_bytes: unsupported type");
+    return 0;
+}
+
+void add_vertex_attribute(VertexFormat *format, GLuint location,
+                          GLint components, GLenum type, GLboolean normalized)
+{
+    assert(format->attributes_count < MAX_VERTEX_ATTRIBUTES);
+
+    VertexAttribute *attribute =
+        &format->attributes[format->attributes_count++];
+
+    attribute->location = location;
+    attribute->components = components;
+    attribute->type = type;
+    attribute->normalized = normalized;
+    attribute->offset = format->stride;
+
+    int bytes = components * vertex_component_bytes(type);
+
+    format->stride += (bytes + 3) & ~3;
+}
+
+void enable_vertex_format(const VertexFormat *format)
+{
+    for (int i = 0; i < format->attributes_count; ++i) {
+        enable_attribute(format->attributes[i].location);
+    }
+}
+
+// Points every attribute at the currently bound GL_ARRAY_BUFFER, with the
+// first vertex starting at base_offset, in the bound vertex array.
+void apply_vertex_format(const VertexFormat *format, GLintptr base_offset)
+{
+    for (int i = 0; i < format->attributes_count; ++i) {
+        const VertexAttribute *attribute = &format->attributes[i];
+
+        glVertexAttribPointer(attribute->location, attribute->components,
+                              attribute->type, attribute->normalized,
+                              format->stride,
+                              (const void *)(base_offset + attribute->offset));
+    }
+}
+
+// The attribute locations the format uses, one bit each
+uint32_t get_vertex_format_mask(const VertexFormat *format)
+{
+    uint32_t mask = 0;
+
+    for (int i = 0; i < format->attributes_count; ++i) {
+        mask |= 1u << format->attributes[i].location;
+    }
+
+    return mask;
+}
+
+// A mesh's vertices in a buffer, in a format, and the indices they're drawn
+// with. Where there are vertex array objects the layout is recorded into one
+// once, so binding it is one call; where there aren't, every bind replays it.
+typedef struct VertexArray
+{
+    GLuint object;
+    GLuint buffer;
+    GLuint index_buffer;
+    VertexFormat format;
+    GLintptr base_offset;
+} VertexArray;
+
+// Sets the layout up in whichever vertex array is bound
+void record_vertex_array(const VertexArray *array)
+{
+    bind_buffer(GL_ARRAY_BUFFER, array->buffer);
+
+    set_enabled_attributes(get_vertex_format_mask(&array->format));
+
+    apply_vertex_format(&array->format, array->base_offset);
+
+    if (array->index_buffer) {
+        bind_buffer(GL_ELEMENT_ARRAY_BUFFER, array->index_buffer);
+    }
+}
+
+// index_buffer can be 0 for vertices drawn with glDrawArrays. Leaves the
+// default vertex array bound, so nothing set up afterwards ends up in this
+// one.
+void create_vertex_array(VertexArray *array, const VertexFormat *format,
+                         GLuint buffer, GLuint index_buffer)
+{
+    array->object = 0;
+    array->buffer = buffer;
+    array->index_buffer = index_buffer;
+    array->format = *format;
+    array->base_offset = 0;
+
+    if (!has_vertex_array_objects()) return;
+
+    array->object = create_vertex_array_object();
+
+    bind_vertex_array_object(array->object);
+    record_vertex_array(array);
+    bind_vertex_array_object(0);
+}
+
+// Binds the array to draw from, with its first vertex base_offset bytes into
+// the buffer. Moving that from where it was last time costs pointing the
+// attributes again, so a mesh that stays put binds in one call.
+void bind_vertex_array(VertexArray *array, GLintptr base_offset)
+{
+    if (!array->object) {
+        array->base_offset = base_offset;
+        record_vertex_array(array);
+        return;
+    }
+
+    bind_vertex_array_object(array->object);
+
+    if (base_offset != array->base_offset) {
+        array->base_offset = base_offset;
+
+        bind_buffer(GL_ARRAY_BUFFER, array->buffer);
+        apply_vertex_format(&array->format, base_offset);
+    }
+}
+
+void delete_vertex_array(VertexArray *array)
+{
+    if (array->object) delete_vertex_array_object(array->object);
+
+    array->object = 0;
+}
+
+// Converts a float in [-1, 1] to a GL_SHORT normalized component
+static inline int16_t pack_snorm16(float f)
+{
+    if (f > 1.0f) f = 1.0f;
+    if (f < -1.0f) f = -1.0f;
+
+    return (int16_t)(f * 32767.0f + (f >= 0.0f ? 0.5f : -0.5f));
+}
+
+// Converts a float in [0, 1] to a GL_UNSIGNED_BYTE normalized component
+static inline uint8_t pack_unorm8(float f)
+{
+    if (f > 1.0f) f = 1.0f;
+    if (f < 0.0f) f = 0.0f;
+
+    return (uint8_t)(f * 255.0f + 0.5f);
+}
+
+// Packs a colour into four GL_UNSIGNED_BYTE components, red first in memory
+static inline uint32_t pack_colour(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+{
+    return (uint32_t)r | ((uint32_t)g << 8) | ((uint32_t)b << 16) |
+           ((uint32_t)a << 24);
+}
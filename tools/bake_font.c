@@ -0,0 +1,113 @@
+// Rasterizes a font's glyphs ahead of time into a file for load_baked_font,
+// so builds with TEXT_BAKED_FONT don't need FreeType or the font itself.
+//
+// Usage: bake_font <font.ttf> <point size> <output> [--sdf] [--chars <text>]
+//
+// Printable ASCII and Latin-1 are always baked; --chars adds the codepoints
+// in a UTF-8 string.
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <GLES2/gl2.h>
+
+#define FONT_NO_GL
+
+#include "../code/maths.c"
+#include "../code/jobs.c"
+#include "../code/font.c"
+
+static const uint32_t baked_ranges[][2] = {
+    {' ', '~'},
+    {0xA0, 0xFF},
+};
+
+bool bake_range(Font *font, uint32_t first, uint32_t last)
+{
+    for (uint32_t codepoint = first; codepoint <= last; ++codepoint) {
+        if (!get_glyph(font, codepoint)) {
+            fprintf(stderr, "bake_font: no room for U+%04X\n", codepoint);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4) {
+        fprintf(stderr, "usage: bake_font <font.ttf> <point size> <output> "
+                        "[--sdf] [--chars <text>]\n");
+        return 1;
+    }
+
+    const char *input = argv[1];
+    int point_size = atoi(argv[2]);
+    const char *output = argv[3];
+
+    FontMode mode = FONT_BITMAP;
+    const char *chars = "";
+
+    for (int i = 4; i < argc; ++i) {
+        if (strcmp(argv[i], "--sdf") == 0) {
+            mode = FONT_SDF;
+        } else if (strcmp(argv[i], "--chars") == 0 && i + 1 < argc) {
+            chars = argv[++i];
+        }
+    }
+
+    FT_Library freetype;
+
+    FT_Error error = FT_Init_FreeType(&freetype);
+    if (error) {
+        fprintf(stderr, "bake_font: FT_Init_FreeType: %d\n", error);
+        return 1;
+    }
+
+    // The font gets the page to itself, as save_baked_font needs
+    AtlasPage *page = calloc(1, sizeof(*page));
+    Font *font = calloc(1, sizeof(*font));
+    if (!page || !font) return 1;
+
+    if (!init_atlas_page(page, mode)) return 1;
+
+    if (!open_font(font, page, freetype, input, point_size)) return 1;
+
+    // Everything is baked in the one frame, so nothing gets evicted
+    begin_atlas_frame(page);
+
+    JobSystem *jobs = calloc(1, sizeof(*jobs));
+    if (!jobs) return 1;
+
+    start_job_system(jobs, count_cores());
+
+    bool preloaded = preload_glyphs(font, jobs, baked_ranges,
+                                    sizeof(baked_ranges) /
+                                        sizeof(baked_ranges[0]));
+
+    stop_job_system(jobs);
+
+    // Anything the preload couldn't fit is reported here
+    if (!preloaded || !bake_range(font, ' ', '~') ||
+        !bake_range(font, 0xA0, 0xFF)) {
+        return 1;
+    }
+
+    while (*chars) {
+        uint32_t codepoint = decode_utf8(&chars);
+
+        if (!bake_range(font, codepoint, codepoint)) return 1;
+    }
+
+    if (!save_baked_font(font, output)) return 1;
+
+    printf("bake_font: %d glyphs from %s into %s\n", page->glyphs_count, input,
+           output);
+
+    return 0;
+}